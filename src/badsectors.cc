@@ -1,6 +1,6 @@
 /**
     \file badsectors.cc
-    Implementation of the B class
+    Implementation of the BadSectorsFile class
     Copyright 2017 by Vincent Fourmond
 
     This program is free software; you can redistribute it and/or modify
@@ -21,6 +21,8 @@
 #include "badsectors.hh"
 
 #include "dvdreader.hh"
+#include "stats.hh"
+#include "trace.hh"
 
 
 #include <stdio.h>
@@ -33,19 +35,65 @@
 
 #include <sys/time.h>
 
+#include <algorithm>
+
 // use of regular expressions !
 #include <regex.h>
 
 
+const char * ReadAttempt::outcomeName(Outcome outcome)
+{
+  switch(outcome) {
+  case Success:
+    return "ok";
+  case ReadError:
+    return "read-error";
+  case InvalidPack:
+    return "invalid-pack";
+  }
+  return "unknown";
+}
+
+int SectorHistory::failures() const
+{
+  int nb = 0;
+  for(auto it = attempts.rbegin(); it != attempts.rend(); ++it) {
+    if(it->outcome == ReadAttempt::Success)
+      break;
+    ++nb;
+  }
+  return nb;
+}
+
+const ReadAttempt * SectorHistory::recovery() const
+{
+  for(auto it = attempts.rbegin(); it != attempts.rend(); ++it) {
+    if(it->outcome == ReadAttempt::Success)
+      return &(*it);
+  }
+  return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////
+
 BadSectorsFile::BadSectorsFile(const std::string & file) :
-  fileName(file)
+  fileName(file), historyStream(NULL), historyFailed(false)
 {
   readBadSectors();
+  readHistory();
+}
+
+BadSectorsFile::~BadSectorsFile()
+{
+  if(historyStream)
+    fclose(historyStream);
 }
 
 /// Write out to the bad sector file
 void BadSectorsFile::writeOut(FILE * out)
 {
+  STATS_TIMER(BadSectorsWrite);
+  Trace::Span span("write bad sectors", "bookkeeping");
   bool shouldClose = false;
   if(! out) {
     if(fileName.empty())
@@ -58,6 +106,8 @@ void BadSectorsFile::writeOut(FILE * out)
   for(auto it = badSectors.begin(); it != badSectors.end(); ++it) {
     const std::string & file = it->first;
     const std::set<int> & lst = it->second;
+    if(lst.empty())
+      continue;
     int first = -1, last = -1;
     for(int cur : lst) {
       if(first < 0) {
@@ -168,7 +218,12 @@ void BadSectorsFile::clearBadSectors(const DVDFileData * file,
 
 std::set<int> BadSectorsFile::badSectorsForFile(const DVDFileData * file)
 {
-  auto it = badSectors.find(file->fileName());
+  return badSectorsForFile(file->fileName());
+}
+
+std::set<int> BadSectorsFile::badSectorsForFile(const std::string & file) const
+{
+  auto it = badSectors.find(file);
   if(it != badSectors.end())
     return it->second;
   else
@@ -179,3 +234,203 @@ void BadSectorsFile::clear()
 {
   badSectors.clear();
 }
+
+std::string BadSectorsFile::historyFileName() const
+{
+  return fileName + ".history";
+}
+
+void BadSectorsFile::readHistory()
+{
+  if(fileName.empty())
+    return;
+  std::string name = historyFileName();
+  FILE * in = fopen(name.c_str(), "r");
+  if(! in)
+    return;                     // no history yet
+
+  char buffer[1024];
+  regex_t re;
+  regmatch_t matches[8];
+  { 
+    int er = regcomp(&re, "([^:]+): *([0-9]+) *\\(([0-9]+)\\) +"
+                     "([0-9.]+) +([0-9.]+) +([a-z-]+) *([^\n]*)",
+                     REG_EXTENDED);
+    if(er) {
+      regerror(er, &re, buffer, sizeof(buffer));
+      fprintf(stderr, "Error building the history regexp: %s", buffer);
+      fclose(in);
+      return;
+    }
+  }
+
+  int line = 0;
+  while(fgets(buffer, sizeof(buffer), in)) {
+    ++line;
+    int status = regexec(&re, buffer, sizeof(matches)/sizeof(regmatch_t),
+                         matches, 0);
+    if(status) {
+      fprintf(stderr, "error parsing line %d of %s: '%s'", line,
+              name.c_str(), buffer);
+      continue;
+    }
+    for(size_t i = 1; i < sizeof(matches)/sizeof(regmatch_t); i++) {
+      if(matches[i].rm_so >= 0)
+        buffer[matches[i].rm_eo] = 0;
+    }
+    std::string file = buffer + matches[1].rm_so;
+    int beg = atoi(buffer + matches[2].rm_so);
+    int size = atoi(buffer + matches[3].rm_so);
+
+    ReadAttempt attempt;
+    attempt.time = atof(buffer + matches[4].rm_so);
+    attempt.latency = atof(buffer + matches[5].rm_so);
+    std::string outcome = buffer + matches[6].rm_so;
+    if(outcome == ReadAttempt::outcomeName(ReadAttempt::Success))
+      attempt.outcome = ReadAttempt::Success;
+    else if(outcome == ReadAttempt::outcomeName(ReadAttempt::InvalidPack))
+      attempt.outcome = ReadAttempt::InvalidPack;
+    else
+      attempt.outcome = ReadAttempt::ReadError;
+    attempt.source = buffer + matches[7].rm_so;
+
+    std::map<int, SectorHistory> & hist = history[file];
+    while(size-- > 0)
+      hist[beg++].attempts.push_back(attempt);
+  }
+  regfree(&re);
+  fclose(in);
+}
+
+void BadSectorsFile::recordAttempt(const std::string & file, int pos, int nb,
+                                   const ReadAttempt & attempt)
+{
+  if(nb <= 0)
+    return;
+  std::map<int, SectorHistory> & hist = history[file];
+  for(int i = 0; i < nb; i++)
+    hist[pos + i].attempts.push_back(attempt);
+
+  if(fileName.empty() || historyFailed)
+    return;
+  if(! historyStream) {
+    std::string name = historyFileName();
+    historyStream = fopen(name.c_str(), "a");
+    if(! historyStream) {
+      // The history only helps scheduling the retries, it is not
+      // worth stopping the copy.
+      fprintf(stderr, "\nWarning: could not open history file %s: %s\n",
+              name.c_str(), strerror(errno));
+      historyFailed = true;
+      return;
+    }
+  }
+  fprintf(historyStream, "%s: %d (%d) %.3f %.6f %s %s\n",
+          file.c_str(), pos, nb, attempt.time, attempt.latency,
+          ReadAttempt::outcomeName(attempt.outcome),
+          attempt.source.c_str());
+  // So that the history is there even if dvdcopy gets killed
+  fflush(historyStream);
+}
+
+void BadSectorsFile::registerFailure(const DVDFileData * file,
+                                     int pos, int nb,
+                                     const ReadAttempt & attempt)
+{
+  std::string name = file->fileName();
+  markBadSectors(name, pos, nb);
+  recordAttempt(name, pos, nb, attempt);
+}
+
+void BadSectorsFile::registerSuccess(const DVDFileData * file,
+                                     int pos, int nb,
+                                     const ReadAttempt & attempt)
+{
+  std::string name = file->fileName();
+  auto it = badSectors.find(name);
+  if(it == badSectors.end())
+    return;
+  std::set<int> & tgt = it->second;
+
+  // We only keep track of the sectors that were bad, grouped in
+  // contiguous runs
+  auto cur = tgt.lower_bound(pos);
+  while(cur != tgt.end() && *cur < pos + nb) {
+    int first = *cur;
+    int last = first;
+    while(cur != tgt.end() && *cur == last && last < pos + nb) {
+      cur = tgt.erase(cur);
+      ++last;
+    }
+    recordAttempt(name, first, last - first, attempt);
+  }
+}
+
+const SectorHistory * BadSectorsFile::sectorHistory(const DVDFileData * file,
+                                                    int sector) const
+{
+  auto it = history.find(file->fileName());
+  if(it == history.end())
+    return NULL;
+  auto it2 = it->second.find(sector);
+  if(it2 == it->second.end())
+    return NULL;
+  return &it2->second;
+}
+
+/// The number of sectors in an ECC block. Sectors of the same ECC
+/// block tend to be recovered together.
+#define ECC_BLOCK 16
+
+int BadSectorsFile::retryPenalty(const DVDFileData * file, int sector) const
+{
+  const SectorHistory * hist = sectorHistory(file, sector);
+  if(! hist)
+    return 0;
+  int penalty = 4 * hist->failures();
+
+  // A sector whose contents are consistently wrong is most probably
+  // garbage written on purpose, retrying is unlikely to change that.
+  if(! hist->attempts.empty() &&
+     hist->attempts.back().outcome == ReadAttempt::InvalidPack)
+    penalty += 2;
+
+  // On the other hand, if other sectors of the same ECC block could
+  // be recovered, there is a fair chance that this one will be too.
+  int first = sector - sector % ECC_BLOCK;
+  for(int s = first; s < first + ECC_BLOCK; s++) {
+    if(s == sector)
+      continue;
+    const SectorHistory * h = sectorHistory(file, s);
+    if(h && h->recovery()) {
+      penalty -= 3;
+      break;
+    }
+  }
+  return penalty;
+}
+
+std::vector<std::pair<int, int> > 
+BadSectorsFile::retryOrder(const DVDFileData * file, int maxAttempts,
+                           bool backwards) const
+{
+  std::vector<std::pair<int, int> > sectors;
+  auto it = badSectors.find(file->fileName());
+  if(it != badSectors.end()) {
+    for(int s : it->second) {
+      if(maxAttempts >= 0) {
+        const SectorHistory * hist = sectorHistory(file, s);
+        if(hist && hist->failures() >= maxAttempts)
+          continue;
+      }
+      sectors.push_back(std::pair<int, int>(retryPenalty(file, s), 
+                                            backwards ? -s : s));
+    }
+  }
+  std::sort(sectors.begin(), sectors.end());
+  std::vector<std::pair<int, int> > retval;
+  for(const auto & p : sectors)
+    retval.push_back(std::pair<int, int>(backwards ? -p.second : p.second,
+                                         p.first));
+  return retval;
+}
@@ -22,7 +22,60 @@
 
 class DVDFileData;
 
+/// One attempt at reading a problematic sector
+class ReadAttempt {
+public:
+  /// What came out of the attempt
+  enum Outcome {
+    /// The sector was read fine
+    Success,
+    /// The drive returned a read error
+    ReadError,
+    /// The sector was read, but does not contain a valid MPEG pack
+    InvalidPack
+  };
+
+  Outcome outcome;
+
+  /// The time at which the attempt was made (seconds since the epoch)
+  double time;
+
+  /// The time the read took, in seconds. As sectors are often read
+  /// in chunks, this is the latency of the whole chunk.
+  double latency;
+
+  /// The pass and the drive that made the attempt, such as
+  /// "second-pass@/dev/dvd"
+  std::string source;
+
+  ReadAttempt(Outcome o = ReadError, double t = 0, double l = 0,
+              const std::string & s = "") :
+    outcome(o), time(t), latency(l), source(s) {;};
+
+  /// Returns the name of the outcome, as used in the history file
+  static const char * outcomeName(Outcome outcome);
+};
+
+/// The history of the read attempts on a given sector
+class SectorHistory {
+public:
+  /// All the attempts, in chronological order
+  std::vector<ReadAttempt> attempts;
+
+  /// The number of failed attempts since the last success
+  int failures() const;
+
+  /// The last successful attempt, or NULL if the sector was never
+  /// recovered.
+  const ReadAttempt * recovery() const;
+};
+
 /// This class represents the whole set of bad sectors in a DVDs
+///
+/// On top of the list of bad sectors, it keeps the history of all
+/// the read attempts on problematic sectors in a companion file
+/// (the bad sectors file name with a @a .history suffix), which is
+/// used to schedule the retries of the second pass.
 class BadSectorsFile {
 protected:
   
@@ -30,13 +83,33 @@ protected:
   /// DVDFileData::fileName()
   std::map<std::string, std::set<int> > badSectors;
 
+  /// The history of the read attempts, indexed like badSectors, and
+  /// then by sector.
+  std::map<std::string, std::map<int, SectorHistory> > history;
+
 
   /// The file name
   std::string fileName;
 
+  /// The name of the history file
+  std::string historyFileName() const;
+
+  /// The history file, opened for appending the attempts, or NULL
+  /// if it is not opened yet.
+  FILE * historyStream;
+
+  /// Whether the history file could not be opened (in which case the
+  /// attempts are only kept in memory).
+  bool historyFailed;
+
+  /// Reads the history of the read attempts
+  void readHistory();
+
+  /// Adds the attempt to the history of the given sectors, and
+  /// appends it to the history file.
+  void recordAttempt(const std::string & file, int pos, int nb,
+                     const ReadAttempt & attempt);
 
-  /// Marks the given sectors as bad sectors
-  void markBadSectors(const std::string & file, int pos, int nb);
 
   /// Marks the given sectors as good sectors
   void clearBadSectors(const std::string & file, int pos, int nb);
@@ -46,6 +119,10 @@ public:
   /// Constructs a file
   BadSectorsFile(const std::string & file);
 
+  BadSectorsFile(const BadSectorsFile &) = delete;
+
+  ~BadSectorsFile();
+
   /// Reads the list of bad sectors from the file
   void readBadSectors();
 
@@ -55,12 +132,53 @@ public:
   /// Marks the given sectors as bad sectors
   void markBadSectors(const DVDFileData * file, int pos, int nb);
 
+  /// Marks the given sectors of the file named @a file (as returned
+  /// by DVDFileData::fileName()) as bad sectors
+  void markBadSectors(const std::string & file, int pos, int nb);
+
   /// Marks the given sectors as good sectors
   void clearBadSectors(const DVDFileData * file, int pos, int nb);
 
   /// Returns the bad sectors for the given file
   std::set<int> badSectorsForFile(const DVDFileData * file);
 
+  /// Returns the bad sectors for the file named @a file (as returned
+  /// by DVDFileData::fileName())
+  std::set<int> badSectorsForFile(const std::string & file) const;
+
+  /// Records a failed attempt at reading the given sectors, and marks
+  /// them as bad.
+  void registerFailure(const DVDFileData * file, int pos, int nb,
+                       const ReadAttempt & attempt);
+
+  /// Records the successful read of the given sectors, and clears
+  /// them. Only the sectors that were bad are added to the history.
+  void registerSuccess(const DVDFileData * file, int pos, int nb,
+                       const ReadAttempt & attempt);
+
+  /// Returns the history of the given sector, or NULL if there was
+  /// never any problem reading it.
+  const SectorHistory * sectorHistory(const DVDFileData * file,
+                                      int sector) const;
+
+  /// Returns the bad sectors of the file that are worth retrying,
+  /// along with their retryPenalty(), in the order in which they
+  /// should be retried: sectors that failed less often, or whose
+  /// neighbours were recovered, come first. The sectors that already
+  /// failed @a maxAttempts times are left out, unless @a maxAttempts
+  /// is negative.
+  ///
+  /// Within sectors of equal likelihood, the sector order is kept
+  /// (reversed if @a backwards is true).
+  std::vector<std::pair<int, int> > retryOrder(const DVDFileData * file,
+                                               int maxAttempts, 
+                                               bool backwards) const;
+
+  /// Returns the likelihood that a retry of the sector fails, as a
+  /// number that is lower for the sectors that should be retried
+  /// first.
+  int retryPenalty(const DVDFileData * file, int sector) const;
+
   /// Clears the bad sectors file
   void clear();
 
@@ -0,0 +1,311 @@
+/**
+    \file copymerger.cc
+    Implementation of the CopyMerger class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "copymerger.hh"
+#include "dvdreader.hh"
+#include "sectorbuffer.hh"
+#include "dvdoutfile.hh"
+#include "flightrecorder.hh"
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <algorithm>
+#include <atomic>
+
+CopyMerger::Copy::Copy(const std::string & dir, const std::string & bsf) :
+  directory(dir), badSectors(new BadSectorsFile(bsf))
+{
+}
+
+CopyMerger::CopyMerger(const std::string & t) : target(t)
+{
+}
+
+void CopyMerger::addCopy(const std::string & directory,
+                         const std::string & badSectors)
+{
+  struct stat dummy;
+  std::string dir = directory + "/VIDEO_TS";
+  if(stat(dir.c_str(), &dummy)) {
+    std::string err = "'" + directory + "' is not a copy of a DVD";
+    throw std::runtime_error(err);
+  }
+  copies.push_back(Copy(directory, badSectors.empty() ?
+                        directory + ".bad" : badSectors));
+}
+
+std::vector<CopyMerger::Part> CopyMerger::listParts() const
+{
+  std::set<std::string> names;
+  for(const Copy & c : copies) {
+    std::string dir = c.directory + "/VIDEO_TS";
+    DIR * d = opendir(dir.c_str());
+    if(! d) {
+      std::string err = "Could not list '" + dir + "': " + strerror(errno);
+      throw std::runtime_error(err);
+    }
+    struct dirent * ent;
+    while((ent = readdir(d))) {
+      std::string name = ent->d_name;
+      struct stat st;
+      if(stat((dir + "/" + name).c_str(), &st) == 0 && S_ISREG(st.st_mode))
+        names.insert(name);
+    }
+    closedir(d);
+  }
+
+  std::vector<Part> parts;
+  for(const std::string & name : names) {
+    Part part;
+    part.name = name;
+    int title, number;
+    char ext[4];
+    // Parts of title VOBs are listed along with the first one, as in
+    // DVDOutFile.
+    if(sscanf(name.c_str(), "VTS_%d_%d.%3s", &title, &number, ext) == 3 &&
+       std::string(ext) == "VOB" && number > 1) {
+      part.badSectorsName = "/VIDEO_TS/" +
+        DVDFileData::fileName(title, DVD_READ_TITLE_VOBS, 1);
+      part.offset = (number - 1) * MAX_FILE_SIZE;
+    }
+    else {
+      part.badSectorsName = "/VIDEO_TS/" + name;
+      part.offset = 0;
+    }
+    parts.push_back(part);
+  }
+  return parts;
+}
+
+/// Copies @a nb sectors starting at @a sector from @a in to the same
+/// position in @a out.
+static void copySectors(int in, int out, int sector, int nb)
+{
+  off_t inPos = (off_t) sector * SECTOR_SIZE;
+  off_t outPos = inPos;
+  size_t left = (size_t) nb * SECTOR_SIZE;
+#ifdef HAVE_COPY_FILE_RANGE
+  // This fails for instance across file systems with older kernels,
+  // in which case we just do it by hand.
+  while(left > 0) {
+    ssize_t done = copy_file_range(in, &inPos, out, &outPos, left, 0);
+    if(done <= 0)
+      break;
+    left -= done;
+  }
+#endif
+  SectorBuffer buffer = SectorArena::global().allocate(64);
+  while(left > 0) {
+    ssize_t done = pread(in, buffer.data(), 
+                         std::min(left, (size_t) 64 * SECTOR_SIZE), inPos);
+    if(done <= 0 || pwrite(out, buffer.data(), done, outPos) != done) {
+      std::string err = "Error while merging: ";
+      err += (done == 0 ? "unexpected end of file" : strerror(errno));
+      throw std::runtime_error(err);
+    }
+    inPos += done;
+    outPos += done;
+    left -= done;
+  }
+}
+
+int CopyMerger::mergePart(const Part & part)
+{
+  std::vector<int> fds(copies.size(), -1);
+  std::vector<int> sizes(copies.size(), 0);
+  std::vector<std::set<int> > bad(copies.size());
+  int size = 0;
+  for(size_t c = 0; c < copies.size(); c++) {
+    std::string name = copies[c].directory + "/VIDEO_TS/" + part.name;
+    fds[c] = open(name.c_str(), O_RDONLY);
+    if(fds[c] < 0)
+      continue;
+    // Copies stopped with --mmap-output are longer than what they hold
+    sizes[c] = std::max(DVDOutFile::writtenSectors(name), 0);
+    size = std::max(size, sizes[c]);
+    bad[c] = copies[c].badSectors->badSectorsForFile(part.badSectorsName);
+  }
+
+  std::string name = target + "/VIDEO_TS/" + part.name;
+  int out = open(name.c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0666);
+  if(out < 0) {
+    std::string err("Failed to open output file '");
+    err += name + "': " + strerror(errno);
+    throw std::runtime_error(err);
+  }
+  // The sectors bad everywhere are left as holes, ie zeros, like the
+  // skipped sectors of a copy.
+  if(ftruncate(out, (off_t) size * SECTOR_SIZE)) {
+    std::string err("Failed to extend output file '");
+    err += name + "': " + strerror(errno);
+    close(out);
+    throw std::runtime_error(err);
+  }
+
+  // The copy the sector is taken from, or -1 if it is bad everywhere
+  auto sourceOf = [&](int sector) -> int {
+    for(size_t c = 0; c < copies.size(); c++)
+      if(sector < sizes[c] && ! bad[c].count(part.offset + sector))
+        return c;
+    return -1;
+  };
+
+  std::vector<int> stillBad;
+  std::vector<int> taken(copies.size(), 0);
+  try {
+    for(int start = 0; start < size; ) {
+      int c = sourceOf(start);
+      int end = start + 1;
+      while(end < size && sourceOf(end) == c)
+        ++end;
+      if(c < 0) {
+        for(int i = start; i < end; i++)
+          stillBad.push_back(part.offset + i);
+      }
+      else {
+        copySectors(fds[c], out, start, end - start);
+        taken[c] += end - start;
+      }
+      start = end;
+    }
+  }
+  catch(...) {
+    close(out);
+    for(int fd : fds)
+      if(fd >= 0)
+        close(fd);
+    throw;
+  }
+  close(out);
+  for(int fd : fds)
+    if(fd >= 0)
+      close(fd);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  for(int s : stillBad)
+    residual->markBadSectors(part.badSectorsName, s, 1);
+  printf("VIDEO_TS/%s: %d sectors", part.name.c_str(), size);
+  for(size_t c = 0; c < copies.size(); c++)
+    if(taken[c] > 0 && taken[c] < size)
+      printf(", %d from %s", taken[c], copies[c].directory.c_str());
+  if(! stillBad.empty())
+    printf(", %d bad in all copies", (int) stillBad.size());
+  printf("\n");
+  fflush(stdout);
+  return stillBad.size();
+}
+
+int CopyMerger::merge(int jobs)
+{
+  if(copies.empty())
+    throw std::runtime_error("Nothing to merge");
+
+  std::string dir = target + "/VIDEO_TS";
+  struct stat dummy;
+  if(stat(target.c_str(), &dummy)) {
+    fprintf(stderr,"Creating directory %s\n", target.c_str());
+    mkdir(target.c_str(), 0755);
+  }
+  if(stat(dir.c_str(), &dummy))  {
+    fprintf(stderr,"Creating directory %s\n", dir.c_str());
+    mkdir(dir.c_str(), 0755);
+  }
+
+  residual.reset(new BadSectorsFile(target + ".bad"));
+  residual->clear();
+
+  // Files that are hard links to each other in the first copy
+  // containing them (duplicates) are merged only once, and linked
+  // afterwards.
+  std::vector<Part> parts = listParts();
+  std::vector<Part> toMerge;
+  std::vector<std::pair<std::string, std::string> > links;
+  std::map<std::pair<dev_t, ino_t>, std::string> inodes;
+  for(const Part & part : parts) {
+    for(const Copy & c : copies) {
+      struct stat st;
+      std::string name = c.directory + "/VIDEO_TS/" + part.name;
+      if(stat(name.c_str(), &st))
+        continue;
+      std::pair<dev_t, ino_t> key(st.st_dev, st.st_ino);
+      auto it = inodes.find(key);
+      if(it != inodes.end())
+        links.push_back(std::make_pair(part.name, it->second));
+      else {
+        inodes[key] = part.name;
+        toMerge.push_back(part);
+      }
+      break;
+    }
+  }
+
+  if(jobs <= 0)
+    jobs = std::max(1U, std::thread::hardware_concurrency());
+  jobs = std::min(jobs, (int) toMerge.size());
+
+  std::atomic<int> next(0);
+  std::atomic<int> bad(0);
+  std::vector<std::exception_ptr> errors(jobs);
+  auto work = [this, &toMerge, &next, &bad, &errors](int job) {
+    FlightRecorder::threadStarted();
+    try {
+      int i;
+      while((i = next++) < (int) toMerge.size())
+        bad += mergePart(toMerge[i]);
+    }
+    catch(...) {
+      errors[job] = std::current_exception();
+      next = toMerge.size();    // Stop the others
+    }
+  };
+  std::vector<std::thread> threads;
+  for(int i = 1; i < jobs; i++)
+    threads.push_back(std::thread(work, i));
+  if(jobs > 0)
+    work(0);
+  for(std::thread & t : threads)
+    t.join();
+  for(std::exception_ptr & e : errors)
+    if(e)
+      std::rethrow_exception(e);
+
+  for(const std::pair<std::string, std::string> & l : links) {
+    std::string source = dir + "/" + l.second;
+    std::string tgt = dir + "/" + l.first;
+    std::cout << "Hardlinking " << tgt << " to " << source << std::endl;
+    if(unlink(tgt.c_str()) && errno != ENOENT) {
+      std::string err("Failed to remove '");
+      err += tgt + "': " + strerror(errno);
+      throw std::runtime_error(err);
+    }
+    if(link(source.c_str(), tgt.c_str())) {
+      std::string err("Failed to link '");
+      err += tgt + "' to '" + source + "': " + strerror(errno);
+      throw std::runtime_error(err);
+    }
+  }
+
+  residual->writeOut();
+  return bad;
+}
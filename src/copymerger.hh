@@ -0,0 +1,100 @@
+/**
+    \file copymerger.hh
+    Merging of several partial copies of the same disc
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __COPYMERGER_H
+#define __COPYMERGER_H
+
+#include "badsectors.hh"
+
+/// Merges several copies of the same disc, made by dvdcopy along
+/// with their bad sectors files, into one target directory.
+///
+/// Each sector is taken from the first copy where it is present and
+/// not listed as bad. The sectors that are bad in all the copies are
+/// listed in the bad sectors file of the target, so that a second
+/// pass can be run on it.
+///
+/// The work is done file by file (ie VOB part by VOB part) by
+/// several threads, and the data are copied using copy_file_range()
+/// when available, which avoids going through user space, and makes
+/// reflinks on file systems that support them.
+class CopyMerger {
+  /// One of the copies
+  class Copy {
+  public:
+    /// The copy directory
+    std::string directory;
+
+    /// Its bad sectors
+    std::unique_ptr<BadSectorsFile> badSectors;
+
+    Copy(const std::string & dir, const std::string & bsf);
+  };
+
+  /// A file to be merged
+  class Part {
+  public:
+    /// The file name, within VIDEO_TS
+    std::string name;
+
+    /// The name under which the bad sectors are listed (the first
+    /// part for title VOBs).
+    std::string badSectorsName;
+
+    /// The position of the first sector of this file in the bad
+    /// sectors list
+    int offset;
+  };
+
+  /// The copies, in order of preference
+  std::vector<Copy> copies;
+
+  /// The target directory
+  std::string target;
+
+  /// The bad sectors that are left
+  std::unique_ptr<BadSectorsFile> residual;
+
+  /// Protects residual and the output
+  std::mutex mutex;
+
+  /// Lists the files to merge, from all the copies
+  std::vector<Part> listParts() const;
+
+  /// Merges the given file. Returns the number of sectors still bad.
+  int mergePart(const Part & part);
+
+public:
+
+  /// Prepares the merge into the @a target directory.
+  CopyMerger(const std::string & target);
+
+  /// Adds a copy, whose bad sectors are listed in the @a badSectors
+  /// file, or the usual one (the directory name followed by .bad) if
+  /// empty.
+  void addCopy(const std::string & directory,
+               const std::string & badSectors = "");
+
+  /// Runs the merge, with @a jobs threads (as many as processors if
+  /// 0 or less). Returns the number of sectors that are bad in all
+  /// copies.
+  int merge(int jobs = 0);
+};
+
+#endif
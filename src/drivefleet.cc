@@ -0,0 +1,416 @@
+/**
+    \file drivefleet.cc
+    Implementation of the DriveFleet class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "drivefleet.hh"
+#include "dvdcopy.hh"
+#include "dvddrive.hh"
+#include "trace.hh"
+#include "flightrecorder.hh"
+#include "jobrecord.hh"
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <algorithm>
+
+/// The time between two looks at the drives and spool directories,
+/// in seconds. Spooled entries modified more recently than that are
+/// assumed to be still being written.
+#define POLL_INTERVAL 2
+
+/// The number of failures in a row after which a drive is reported
+/// as suspect.
+#define SUSPECT_FAILURES 3
+
+DriveFleet::Source::Source(const std::string & dev) :
+  device(dev), state("starting"), discs(0), successes(0), failures(0),
+  consecutiveFailures(0), sectors(0), skipped(0), readTime(0),
+  currentRate(0), remaining(0), retry(0), healthWritten(0)
+{
+  struct stat st;
+  isSpool = (stat(dev.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+  std::string d = dev;
+  while(d.size() > 1 && d[d.size() - 1] == '/')
+    d.erase(d.size() - 1);
+  size_t idx = d.rfind('/');
+  name = (idx == std::string::npos ? d : d.substr(idx + 1));
+}
+
+DriveFleet::DriveFleet(const std::string & out, const DVDCopy & opts) :
+  output(out), options(opts), writers(0), stopping(false), maxWriters(2)
+{
+}
+
+void DriveFleet::addSource(const std::string & device)
+{
+  sources.push_back(std::unique_ptr<Source>(new Source(device)));
+}
+
+void DriveFleet::writeStatus()
+{
+  JobRecord status;
+  for(const std::unique_ptr<Source> & src : sources)
+    status.set(src->name, src->state);
+  status.set("writers", std::to_string(writers) + "/" + 
+             std::to_string(maxWriters));
+  std::string names;
+  for(const Source * src : waiting)
+    names += (names.empty() ? "" : " ") + src->name;
+  status.set("waiting", names);
+  try {
+    status.write(output + "/fleet.status");
+  }
+  catch(const std::exception & e) {
+    fprintf(stderr, "%s\n", e.what());
+  }
+}
+
+void DriveFleet::writeHealth(const Source & src)
+{
+  JobRecord health;
+  health.set("device", src.device);
+  health.set("state", src.state);
+  health.set("status", src.consecutiveFailures >= SUSPECT_FAILURES ? 
+             "suspect" : "ok");
+  health.set("discs", (long long) src.discs);
+  health.set("successes", (long long) src.successes);
+  health.set("failures", (long long) src.failures);
+  health.set("consecutive-failures", (long long) src.consecutiveFailures);
+  health.set("sectors", src.sectors);
+  health.set("skipped", src.skipped);
+  health.set("rate", src.readTime > 0 ? 
+             src.sectors * 2048e-6 / src.readTime : 0.0);
+  health.set("current-rate", src.currentRate * 1e-6);
+  health.set("remaining", src.remaining);
+  health.set("retry", src.retry);
+  health.set("last-disc", src.lastDisc);
+  health.set("last-error", src.lastError);
+  health.set("updated", (long long) time(NULL));
+  try {
+    health.write(output + "/" + src.name + ".health");
+  }
+  catch(const std::exception & e) {
+    fprintf(stderr, "%s\n", e.what());
+  }
+}
+
+void DriveFleet::setState(Source & src, const std::string & state)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  src.state = state;
+  writeStatus();
+  writeHealth(src);
+}
+
+void DriveFleet::pause()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  if(! stopping)
+    cond.wait_for(lock, std::chrono::seconds(POLL_INTERVAL));
+  if(stopping)
+    throw Stopped();
+}
+
+void DriveFleet::acquireSlot(Source & src)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  src.state = "waiting to write";
+  waiting.push_back(&src);
+  writeStatus();
+  while(! stopping && (writers >= maxWriters || waiting.front() != &src))
+    cond.wait(lock);
+  if(stopping) {
+    waiting.erase(std::find(waiting.begin(), waiting.end(), &src));
+    throw Stopped();
+  }
+  waiting.pop_front();
+  ++writers;
+  writeStatus();
+  // The next one may be able to go too
+  cond.notify_all();
+}
+
+void DriveFleet::releaseSlot()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  --writers;
+  writeStatus();
+  cond.notify_all();
+}
+
+bool DriveFleet::runJob(Source & src, const std::string & disc,
+                        const std::string & target)
+{
+  acquireSlot(src);
+  setState(src, "copying " + disc);
+  printf("%s: copying %s to %s\n", src.name.c_str(), disc.c_str(),
+         target.c_str());
+  fflush(stdout);
+
+  struct timeval before, after;
+  gettimeofday(&before, NULL);
+  std::string error;
+  int skipped = 0;
+  long long sectors = 0;
+  bool writing = true;
+  try {
+    DVDCopy dvd;
+    dvd.copyOptions(options);
+    // The metrics are those of the drive or the spool directory
+    dvd.metricsName = src.device;
+    dvd.watchProgress([this, &src](const Progress & p) {
+        std::lock_guard<std::mutex> lock(mutex);
+        src.currentRate = p.rate();
+        src.remaining = p.remainingTime();
+        src.retry = p.retryTime();
+        // Once a second is enough
+        if(time(NULL) != src.healthWritten) {
+          src.healthWritten = time(NULL);
+          writeHealth(src);
+        }
+      });
+    skipped = dvd.copy(disc.c_str(), target.c_str());
+    sectors = dvd.progress().totalSectors;
+
+    // The second pass spends its time retrying bad sectors and
+    // writes little, so it does not hold up the other drives.
+    releaseSlot();
+    writing = false;
+    if(skipped > 0)
+      dvd.secondPass(disc.c_str(), target.c_str());
+  }
+  catch(const std::exception & e) {
+    error = e.what();
+  }
+  if(writing)
+    releaseSlot();
+  gettimeofday(&after, NULL);
+  double duration = (after.tv_sec - before.tv_sec)*1.0 + 
+    1e-6 * (after.tv_usec - before.tv_usec);
+
+  JobRecord record;
+  record.set("source", src.device);
+  record.set("disc", disc);
+  record.set("started", (long long) before.tv_sec);
+  record.set("duration", duration);
+  record.set("sectors", sectors);
+  if(error.empty()) {
+    record.set("status", "success");
+    record.set("skipped", (long long) skipped);
+  }
+  else {
+    record.set("status", "failed");
+    record.set("error", error);
+  }
+  try {
+    record.write(target + ".result");
+  }
+  catch(const std::exception & e) {
+    fprintf(stderr, "%s\n", e.what());
+  }
+
+  printf("\n%s: done with %s: %s\n", src.name.c_str(), disc.c_str(),
+         error.empty() ? "success" : error.c_str());
+  fflush(stdout);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  src.discs++;
+  src.lastDisc = disc;
+  src.currentRate = 0;
+  src.remaining = 0;
+  src.retry = 0;
+  if(error.empty()) {
+    src.successes++;
+    src.consecutiveFailures = 0;
+    src.sectors += sectors;
+    src.skipped += skipped;
+    src.readTime += duration;
+  }
+  else {
+    src.failures++;
+    src.consecutiveFailures++;
+    src.lastError = error;
+  }
+  writeHealth(src);
+  return error.empty();
+}
+
+/// The fingerprint of the disc in the drive, or an empty string if it
+/// cannot be read.
+static std::string discFingerprint(const std::string & device)
+{
+  try {
+    DVDSource disc(device.c_str());
+    return disc.fingerprint();
+  }
+  catch(const std::exception & e) {
+    return std::string();
+  }
+}
+
+void DriveFleet::driveWorker(Source & src)
+{
+  while(true) {
+    setState(src, "waiting for a disc");
+    while(DVDDrive::discStatus(src.device.c_str()) == DVDDrive::NoDisc)
+      pause();
+
+    setState(src, "identifying the disc");
+    std::string fingerprint;
+    try {
+      DVDSource disc(src.device.c_str());
+      fingerprint = disc.fingerprint();
+    }
+    catch(const std::exception & e) {
+      // The drive may not be done loading the disc
+      printf("%s: %s\n", src.name.c_str(), e.what());
+      pause();
+      continue;
+    }
+
+    // Discs whose copy failed are copied again
+    std::string target = output + "/" + fingerprint;
+    JobRecord record;
+    if(record.read(target + ".result") &&
+       record.get("status") == "success")
+      printf("%s: the disc was already copied to %s\n", src.name.c_str(),
+             target.c_str());
+    else
+      runJob(src, src.device, target);
+
+    setState(src, "waiting for the disc to be removed");
+    DVDDrive::eject(src.device.c_str());
+    while(true) {
+      DVDDrive::DiscStatus status = DVDDrive::discStatus(src.device.c_str());
+      if(status == DVDDrive::NoDisc)
+        break;
+      // Drives that cannot tell whether they hold a disc have a new
+      // one once the fingerprint changes, or cannot be read at all.
+      if(status == DVDDrive::UnknownStatus &&
+         discFingerprint(src.device) != fingerprint)
+        break;
+      pause();
+    }
+  }
+}
+
+void DriveFleet::spoolWorker(Source & src)
+{
+  std::string done = src.device + "/done";
+  std::string failed = src.device + "/failed";
+  mkdir(done.c_str(), 0755);
+  mkdir(failed.c_str(), 0755);
+
+  while(true) {
+    setState(src, "waiting for a disc");
+    std::string next;
+    while(next.empty()) {
+      std::vector<std::string> names;
+      DIR * d = opendir(src.device.c_str());
+      if(d) {
+        struct dirent * ent;
+        time_t limit = time(NULL) - POLL_INTERVAL;
+        while((ent = readdir(d))) {
+          std::string name = ent->d_name;
+          struct stat st;
+          if(name[0] == '.' || name == "done" || name == "failed" ||
+             stat((src.device + "/" + name).c_str(), &st) ||
+             st.st_mtime > limit)
+            continue;
+          names.push_back(name);
+        }
+        closedir(d);
+      }
+      if(names.empty())
+        pause();
+      else
+        next = *std::min_element(names.begin(), names.end());
+    }
+
+    std::string disc = src.device + "/" + next;
+    std::string base = next.substr(0, next.rfind('.'));
+    if(base.empty())
+      base = next;
+    bool success = runJob(src, disc, output + "/" + base);
+    std::string moved = (success ? done : failed) + "/" + next;
+    if(rename(disc.c_str(), moved.c_str())) {
+      // Better stop than copying the same thing over and over again
+      std::string err = "Could not move '" + disc + "' to '" + 
+        moved + "': " + strerror(errno);
+      throw std::runtime_error(err);
+    }
+  }
+}
+
+void DriveFleet::run()
+{
+  if(sources.empty())
+    throw std::runtime_error("No drives to watch");
+  struct stat st;
+  if(stat(output.c_str(), &st)) {
+    fprintf(stderr,"Creating directory %s\n", output.c_str());
+    mkdir(output.c_str(), 0755);
+  }
+
+  // A worker stopping on an error stops the whole fleet, since it
+  // would not be noticed otherwise.
+  std::exception_ptr error;
+  for(std::unique_ptr<Source> & s : sources) {
+    Source * src = s.get();
+    printf("Watching %s %s\n", src->isSpool ? "spool directory" : "drive",
+           src->device.c_str());
+    src->thread = std::thread([this, src, &error]() {
+        Trace::nameThread(src->device);
+        FlightRecorder::threadStarted();
+        try {
+          if(src->isSpool)
+            spoolWorker(*src);
+          else
+            driveWorker(*src);
+        }
+        catch(const Stopped &) {
+        }
+        catch(...) {
+          std::lock_guard<std::mutex> lock(mutex);
+          if(! error)
+            error = std::current_exception();
+          stopping = true;
+          cond.notify_all();
+        }
+      });
+  }
+  fflush(stdout);
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(! error)
+      cond.wait(lock);
+  }
+  // The workers use the fleet, so they must be done before it goes
+  printf("\nStopping the other workers, once their copies are done\n");
+  fflush(stdout);
+  for(std::unique_ptr<Source> & s : sources)
+    s->thread.join();
+  std::rethrow_exception(error);
+}
@@ -0,0 +1,163 @@
+/**
+    \file drivefleet.hh
+    Copying the discs of several drives as a service
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DRIVEFLEET_H
+#define __DRIVEFLEET_H
+
+#include "jobrecord.hh"
+
+class DVDCopy;
+
+/// Copies the discs inserted in a set of drives, with one worker per
+/// drive, forever.
+///
+/// A worker waits for a disc to be inserted in its drive, copies it
+/// to a directory of the output directory named after its
+/// fingerprint (see DVDSource::fingerprint()), ejects it and waits
+/// for the next one. Discs already copied successfully are ejected
+/// right away, the others are copied again.
+///
+/// A source can also be a spool directory, which stands in for a
+/// drive: each image or copy that appears in it is processed like an
+/// inserted disc, and moved to the done or failed subdirectory
+/// afterwards. It is copied to a directory named after it.
+///
+/// All the workers share a scheduler that lets at most maxWriters
+/// jobs run their first pass at the same time, in the order in which
+/// they asked; the second passes, which mostly retry bad sectors,
+/// run outside of it. The output directory holds:
+///  - a record of each job, as the target followed by .result;
+///  - a health record for each drive, as its name followed by
+///    .health, with the success rate and read speed, and the current
+///    rate and estimated time left while copying;
+///  - fleet.status, describing what each drive is doing and which
+///    ones are waiting to write.
+class DriveFleet {
+  /// A drive or spool directory, and its worker
+  class Source {
+  public:
+    /// The device or directory
+    std::string device;
+
+    /// The name of the source in the records
+    std::string name;
+
+    /// Whether the source is a spool directory
+    bool isSpool;
+
+    /// What the worker is doing
+    std::string state;
+
+    /// Statistics for the health record
+    int discs;
+    int successes;
+    int failures;
+    int consecutiveFailures;
+    long long sectors;
+    long long skipped;
+    double readTime;
+    std::string lastDisc;
+    std::string lastError;
+
+    /// The estimates of the current copy (see Progress), updated
+    /// while it runs
+    double currentRate;
+    double remaining;
+    double retry;
+
+    /// When the health record was last written during the copy
+    time_t healthWritten;
+
+    std::thread thread;
+
+    Source(const std::string & dev);
+  };
+
+  /// Where the copies go
+  std::string output;
+
+  /// The options of the copies (see DVDCopy::copyOptions())
+  const DVDCopy & options;
+
+  std::vector<std::unique_ptr<Source> > sources;
+
+  /// Protects the state of the sources and the scheduler
+  std::mutex mutex;
+  std::condition_variable cond;
+
+  /// The number of jobs writing
+  int writers;
+
+  /// The sources waiting to write, in the order they asked
+  std::deque<Source *> waiting;
+
+  /// Whether the workers should stop, after one of them failed
+  bool stopping;
+
+  /// Thrown to the workers when they should stop
+  class Stopped {};
+
+  /// Waits for a while before polling the source again, or throws
+  /// Stopped if the workers should stop.
+  void pause();
+
+  /// Waits until the source can start writing, or throws Stopped if
+  /// the workers should stop.
+  void acquireSlot(Source & src);
+
+  /// Tells that a source has finished writing.
+  void releaseSlot();
+
+  /// Sets the state of the source and updates the status file and
+  /// its health record.
+  void setState(Source & src, const std::string & state);
+
+  /// Writes fleet.status. The mutex must be held.
+  void writeStatus();
+
+  /// Writes the health record of the source. The mutex must be held.
+  void writeHealth(const Source & src);
+
+  /// Copies @a disc (the device for drives) to @a target, and
+  /// records the outcome. Returns true on success.
+  bool runJob(Source & src, const std::string & disc, 
+              const std::string & target);
+
+  /// The workers
+  void driveWorker(Source & src);
+  void spoolWorker(Source & src);
+
+public:
+
+  /// The maximum number of jobs running their first pass at the same
+  /// time
+  int maxWriters;
+
+  DriveFleet(const std::string & output, const DVDCopy & options);
+
+  /// Adds a drive, or a spool directory.
+  void addSource(const std::string & device);
+
+  /// Runs the workers, forever. If one of them fails, the others
+  /// are stopped (once their current copy is done), and its error is
+  /// thrown.
+  void run();
+};
+
+#endif
@@ -29,8 +29,10 @@
 #include <dvdread/nav_read.h>
 
 #include <unistd.h>
+#include <sys/mman.h>
 
 #define BUF_SECS 8192
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
 /*
  * the minimum time for one DVD sector:
  * 2048 byte = 16384 bit @10.08Mbps
@@ -43,17 +45,26 @@
 
 /* globals */
 /* OK, I know I'm wasting memory, but, well, the time when a full DVD
-   couldn't fit in the RAM is long long gone... */
-uint8_t    buf[BUF_SECS * DVD_VIDEO_LB_LEN];
-uint8_t    buf2[BUF_SECS * DVD_VIDEO_LB_LEN];
+   couldn't fit in the RAM is long long gone... They are allocated
+   by alloc_buffers(), aligned on huge pages if possible. */
+uint8_t   *buf;
+uint8_t   *buf2;
 /* buffer for the output */
-uint8_t    out_buf[2 * BUF_SECS * DVD_VIDEO_LB_LEN];
+uint8_t   *out_buf;
 /*  */
 int        buf_top = 0;
 int        max_read_retries;
 int        read_error_count;
 int        ignore_read_errors;
 int        report_cell_gaps;
+/* cache-busting: before some retries, read bust_size sectors
+   bust_distance sectors away, so that the drive really reads the
+   sector again instead of returning the failure in its cache */
+int        bust_distance = 4096;
+int        bust_size = 16;
+/* statistics about retries, used to choose the retry strategy */
+int        plain_retries, plain_successes;
+int        bust_retries, bust_successes;
 const char progname [] = "dump_stream";
 
 
@@ -61,6 +72,7 @@ const char progname [] = "dump_stream";
 int  get_int (const char *);
 void play_cell(const char *, int, int, int);
 void usage (void);
+void alloc_buffers (void);
 void warning (const char *, ...);
 void fatal (const char *, ...);
 
@@ -77,6 +89,8 @@ main (int argc, char *const argv [])
       { "max-retries",   1, NULL, 'r' },
       { "report-gaps",   0, NULL, 'g' },
       { "no-sort",   0, NULL, 'N' },
+      { "bust-distance", 1, NULL, 'd' },
+      { "bust-size",     1, NULL, 's' },
       { NULL,            0, NULL, 0   }
     };
 
@@ -85,7 +99,7 @@ main (int argc, char *const argv [])
   
   
 
-  while ((c = getopt_long_only (argc, argv, "ir:gN", long_options, NULL)) >= 0)
+  while ((c = getopt_long_only (argc, argv, "ir:gNd:s:", long_options, NULL)) >= 0)
     {
       switch (c)
         {
@@ -104,6 +118,16 @@ main (int argc, char *const argv [])
           do_sort = 0;
           break;
 
+        case 'd':
+          bust_distance = get_int (optarg);
+          break;
+
+        case 's':
+          bust_size = get_int (optarg);
+          if (bust_size > BUF_SECS)
+            bust_size = BUF_SECS;
+          break;
+
         default:
           putc ('\n', stderr);
           usage ();
@@ -113,6 +137,8 @@ main (int argc, char *const argv [])
   if (argc - optind < 4)
     usage ();
 
+  alloc_buffers ();
+
   i = optind;
 
   dev  = argv [i++];
@@ -128,10 +154,40 @@ main (int argc, char *const argv [])
   if (read_error_count)
     warning ("encountered a total of %d read error(s)", read_error_count);
 
+  if (plain_retries + bust_retries)
+    fprintf (stderr, "%s: retries: %d/%d plain, %d/%d after reading elsewhere\n",
+             progname, plain_successes, plain_retries,
+             bust_successes, bust_retries);
+
   return 0;
 }
 
 
+/* allocates a buffer of the given number of sectors, aligned so
+   that the system can use huge pages for it */
+static uint8_t *
+alloc_sectors (size_t sectors)
+{
+  void  *ptr;
+  size_t size = sectors * DVD_VIDEO_LB_LEN;
+
+  if (posix_memalign (&ptr, HUGE_PAGE_SIZE, size))
+    fatal ("could not allocate %lu bytes", (unsigned long) size);
+#ifdef MADV_HUGEPAGE
+  madvise (ptr, size, MADV_HUGEPAGE);
+#endif
+  return ptr;
+}
+
+void
+alloc_buffers (void)
+{
+  buf     = alloc_sectors (BUF_SECS);
+  buf2    = alloc_sectors (BUF_SECS);
+  out_buf = alloc_sectors (2 * BUF_SECS);
+}
+
+
 /* get integer from string */
 int
 get_int (const char *arg)
@@ -181,6 +237,67 @@ dvd_read_blocks (int nav, dvd_file_t *fh, int sector, int count, uint8_t *ptr)
 }
 
 
+/*
+ * decide whether the next retry should be done after reading
+ * elsewhere, based on the success rates of both approaches so far;
+ * one retry out of 10 uses the approach that looks worse, in case
+ * things change.
+ */
+static int
+should_bust (void)
+{
+  double plain, bust;
+  int    best;
+
+  if (bust_distance <= 0 || bust_size <= 0)
+    return 0;
+
+  if (plain_retries < 4 || bust_retries < 4)
+    return bust_retries <= plain_retries;
+
+  plain = (plain_successes + 1.0) / (plain_retries + 2.0);
+  bust  = (bust_successes + 1.0) / (bust_retries + 2.0);
+  best  = bust > plain;
+
+  if ((plain_retries + bust_retries) % 10 == 9)
+    return !best;
+  return best;
+}
+
+
+static void
+record_retry (int busted, int success)
+{
+  if (busted)
+    {
+      bust_retries++;
+      bust_successes += success;
+    }
+  else
+    {
+      plain_retries++;
+      plain_successes += success;
+    }
+}
+
+
+/* read sectors far away from sector, to flush the drive cache */
+static void
+bust_cache (dvd_file_t *fh, int sector)
+{
+  int size = DVDFileSize (fh);
+  int far  = sector + bust_distance;
+
+  if (far + bust_size > size)
+    far = sector - bust_distance - bust_size;
+  if (far < 0)
+    far = 0;
+
+  /* buf2 is only used as a temporary in play_cell */
+  dvd_read_blocks (0, fh, far, bust_size, buf2);
+}
+
+
 /* check if ptr points to nav pack */
 static inline int
 is_nav_pack (uint8_t *ptr)
@@ -345,8 +462,16 @@ read_nav_pack (dvd_file_t *fh, dsi_t *dsi,
   /* try max_read_retries+1 times */
   for (i = 0; i <= max_read_retries; i++)
     {
+      int busted = i > 0 && should_bust ();
+
+      if (busted)
+        bust_cache (fh, sector);
+
       n = dvd_read_blocks (1, fh, sector, 1, buf);
 
+      if (i > 0)
+        record_retry (busted, n == 1);
+
       if (n == 1)
         {
           /* read Ok */
@@ -385,8 +510,16 @@ read_nav_pack (dvd_file_t *fh, dsi_t *dsi,
       /* again try max_read_retries+1 times for each sector */
       for (i = 0; i <= max_read_retries; i++)
         {
+          int busted = i > 0 && should_bust ();
+
+          if (busted)
+            bust_cache (fh, sector + offs);
+
           n = dvd_read_blocks (0, fh, sector + offs, 1, buf);
 
+          if (i > 0)
+            record_retry (busted, n == 1);
+
           if (n == 1 && buf [14] == 0 && buf [15] == 0 && buf [16] == 1)
             {
               /* read Ok */
@@ -457,12 +590,21 @@ read_blocks (dvd_file_t *fh, int sector, int count, uint64_t last_scr)
    * second:             try to read a single sector,
    *                     if that fails (due to bad sector):
    * third to
-   * max_read_retries+2: retry the sector
+   * max_read_retries+2: retry the sector, possibly after reading
+   *                     elsewhere (see should_bust)
    */
   for (i = 0; i < max_read_retries + 2; i++)
     {
+      int busted = i > 1 && should_bust ();
+
+      if (busted)
+        bust_cache (fh, sector);
+
       n = dvd_read_blocks (0, fh, sector, count, buf);
 
+      if (i > 1)
+        record_retry (busted, n == count);
+
       if (n == count)
         /* this is what we want */
         return n;
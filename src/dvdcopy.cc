@@ -26,6 +26,14 @@
 #include "dvddrive.hh"
 
 #include "badsectors.hh"
+#include "retryscheduler.hh"
+#include "pipeline.hh"
+#include "ratelimiter.hh"
+#include "eventlog.hh"
+#include "metrics.hh"
+#include "stats.hh"
+#include "trace.hh"
+#include "flightrecorder.hh"
 
 #include <stdio.h>
 
@@ -34,116 +42,199 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include <sys/time.h>
 
+#include <algorithm>
+#include <atomic>
+
 // use of regular expressions !
 #include <regex.h>
 
-void Progress::setupForCopying(const std::vector<DVDFileData * > & files)
+double Progress::refreshRate = 4;
+
+/// The time over which the read rate is averaged, in seconds
+#define RATE_WINDOW 20
+
+/// The weight of the last failed read in the average latency
+#define LATENCY_WEIGHT 0.2
+
+Progress::Progress() : nbFiles(0), currentFile(NULL), displayDone(false),
+                       averageRate(0), lastDone(0), failedLatency(-1),
+                       totalSectors(0), sectorsDone(0), totalSkipped(0)
+{
+}
+
+Progress::~Progress()
+{
+  stopDisplay();
+}
+
+void Progress::setupFiles(const std::vector<DVDFileData * > & files)
 {
+  nbFiles = 0;
+  for(const DVDFileData * file : files)
+    nbFiles = std::max(nbFiles, file->index + 1);
+  progresses.reset(new FileProgress[nbFiles]);
+  for(int i = 0; i < nbFiles; i++) {
+    progresses[i].totalSectors = 0;
+    progresses[i].sectorsDone = 0;
+    progresses[i].skippedSectors = 0;
+  }
   totalSectors = 0;
   totalSkipped = 0;
   sectorsDone = 0;
+  currentFile = NULL;
+  std::lock_guard<std::mutex> lock(estimateMutex);
+  averageRate = 0;
+  lastDone = 0;
+  failedLatency = -1;
+}
+
+Progress::FileProgress & Progress::fileProgress(const DVDFileData * file) const
+{
+  if(file->index < 0 || file->index >= nbFiles)
+    throw std::runtime_error("Could not find the file for the progress");
+  return progresses[file->index];
+}
+
+void Progress::setupForCopying(const std::vector<DVDFileData * > & files)
+{
+  setupFiles(files);
   for(auto it = files.begin(); it != files.end(); it++) {
     DVDFileData * file = *it;
-    FileProgress pg;
+    FileProgress & pg = fileProgress(file);
     pg.totalSectors = (file->dup ? 0 : file->size/2048);
     totalSectors += pg.totalSectors;
-    pg.sectorsDone = 0;
-    pg.skippedSectors = 0;
-    progresses.insert(std::pair<const DVDFileData *, FileProgress>(file, pg));
     DVDFileData * base = DVDFileData::findBase(files, file);
     if(base) {
-      auto it2 = progresses.find(base);
-      if(it2 == progresses.end())
+      if(base->index > file->index)
         throw std::runtime_error("Processing number 2 after number 1");
-      it2->second.totalSectors += pg.totalSectors;
-      pg.totalSectors = 0;
+      fileProgress(base).totalSectors += pg.totalSectors;
     }
   }
-  /// @todo Use std::chrono
-  gettimeofday(&startTime, NULL);
+  startTime = std::chrono::steady_clock::now();
+  lastUpdate = startTime;
 }
 
 void Progress::setupForSecondPass(const std::vector<DVDFileData * > & files,
-                                  BadSectorsFile * badSectors)
+                                  const std::vector<Retry> & retries)
 {
-  totalSectors = 0;
-  totalSkipped = 0;
-  sectorsDone = 0;
-  for(auto it = files.begin(); it != files.end(); it++) {
-    DVDFileData * file = *it;
-    FileProgress pg;
-    int nb = badSectors->badSectorsForFile(file).size();
-
-    pg.totalSectors = nb;
-    totalSectors += pg.totalSectors;
-    pg.sectorsDone = 0;
-    pg.skippedSectors = 0;
-    progresses.insert(std::pair<const DVDFileData *, FileProgress>(file, pg));
+  setupFiles(files);
+  for(const Retry & r : retries) {
+    fileProgress(files[r.file]).totalSectors++;
+    totalSectors++;
   }
-  /// @todo Use std::chrono
-  gettimeofday(&startTime, NULL);
+  startTime = std::chrono::steady_clock::now();
+  lastUpdate = startTime;
 }
 
 void Progress::successfulRead(const DVDFileData * file, int nb)
 {
-  auto it = progresses.find(file);
-  if(it == progresses.end())
-    throw std::runtime_error("Could not find the file for the progress");
-  FileProgress & progress = it->second;
-  progress.sectorsDone += nb;
+  fileProgress(file).sectorsDone += nb;
   sectorsDone += nb;
 }
 
 void Progress::finishedFile(const DVDFileData * file)
 {
-  auto it = progresses.find(file);
-  if(it == progresses.end())
-    throw std::runtime_error("Could not find the file for the progress");
-  FileProgress & progress = it->second;
-  sectorsDone += progress.totalSectors - progress.sectorsDone;
-  progress.sectorsDone = progress.totalSectors;
+  FileProgress & progress = fileProgress(file);
+  int done = progress.sectorsDone.exchange(progress.totalSectors);
+  sectorsDone += progress.totalSectors - done;
 }
 
-void Progress::failedRead(const DVDFileData * file, int nb)
+void Progress::failedRead(const DVDFileData * file, int nb, double latency)
 {
-  auto it = progresses.find(file);
-  if(it == progresses.end())
-    throw std::runtime_error("Could not find the file for the progress");
-  FileProgress & progress = it->second;
+  FileProgress & progress = fileProgress(file);
   progress.sectorsDone += nb;
   progress.skippedSectors += nb;
   sectorsDone += nb;
   totalSkipped += nb;
+  if(latency >= 0) {
+    std::lock_guard<std::mutex> lock(estimateMutex);
+    if(failedLatency < 0)
+      failedLatency = latency;
+    else
+      failedLatency += LATENCY_WEIGHT * (latency - failedLatency);
+  }
 }
 
+void Progress::update()
+{
+  std::chrono::steady_clock::time_point now = 
+    std::chrono::steady_clock::now();
+  int done = sectorsDone;
+  std::lock_guard<std::mutex> lock(estimateMutex);
+  std::chrono::duration<double> elapsed = now - startTime;
+  std::chrono::duration<double> dt = now - lastUpdate;
+  if(dt.count() <= 0)
+    return;
+  double current = (done - lastDone) / dt.count();
+  // At first, the average over the whole operation is more reliable
+  if(elapsed.count() < RATE_WINDOW)
+    averageRate = done / elapsed.count();
+  else
+    averageRate += (1 - exp(-dt.count()/RATE_WINDOW)) * 
+      (current - averageRate);
+  lastUpdate = now;
+  lastDone = done;
+}
 
-void Progress::writeCurrentProgress(const DVDFileData * file) const
+double Progress::rate() const
 {
-  struct timeval current;
+  std::lock_guard<std::mutex> lock(estimateMutex);
+  return averageRate * 2048;
+}
+
+double Progress::remainingTime() const
+{
+  int left = totalSectors - sectorsDone;
+  std::lock_guard<std::mutex> lock(estimateMutex);
+  if(left <= 0)
+    return 0;
+  if(averageRate <= 0)
+    return -1;
+  return left / averageRate;
+}
+
+double Progress::retryTime() const
+{
+  int skipped = totalSkipped;
+  std::lock_guard<std::mutex> lock(estimateMutex);
+  return failedLatency > 0 ? skipped * failedLatency : 0;
+}
 
+
+void Progress::writeCurrentProgress() const
+{
+  STATS_TIMER(ProgressRender);
+  Trace::Span span("show progress", "bookkeeping");
   double elapsed_seconds;
   double estimated_seconds;
   double rate;
   const char * rate_suffix;
 
-  auto it = progresses.find(file);
-  if(it == progresses.end())
-    throw std::runtime_error("Could not find the file for the progress");
-  const FileProgress & progress = it->second;
+  int skipped = 0;
+  const DVDFile * file = currentFile;
+  if(file) {
+    const DVDFileData * dat = file->fileData();
+    int blk = file->position;
+    std::string fileName = dat->fileName(true, blk);
+    printf("\r%s: %7d/%d", fileName.c_str(), blk, (int) file->positionSize);
+    skipped = fileProgress(dat).skippedSectors;
+  }
+  else
+    printf("\r");
 
   // Progress report
-  gettimeofday(&current, NULL);
-
-  int remaining = totalSectors - sectorsDone;
-
-  elapsed_seconds = (current.tv_sec - startTime.tv_sec)*1.0 + 
-    1e-6 * (current.tv_usec - startTime.tv_usec);
-  estimated_seconds = (elapsed_seconds * (totalSectors))/
-    sectorsDone;
-  rate = ((sectorsDone) * 2048.)/(elapsed_seconds);
+  std::chrono::duration<double> elapsed = 
+    std::chrono::steady_clock::now() - startTime;
+  int done = sectorsDone;
+
+  elapsed_seconds = elapsed.count();
+  double remaining = remainingTime();
+  estimated_seconds = elapsed_seconds + (remaining > 0 ? remaining : 0);
+  rate = this->rate();
   if(rate >= 1e6) {
     rate_suffix = "MB/s";
     rate /= 1e6;
@@ -156,28 +247,135 @@ void Progress::writeCurrentProgress(const DVDFileData * file) const
     rate_suffix = "B/s";
   printf(" %d skipped, total: %1.3g/%1.3g GB, %d skipped "
          "(%02d:%02d out of %02d:%02d, %1.1f%s)",
-         progress.skippedSectors,
-         sectorsDone*(1.0/(512*1024)), totalSectors*(1.0/(512*1024)), totalSkipped,
+         skipped,
+         done*(1.0/(512*1024)), totalSectors*(1.0/(512*1024)), 
+         (int) totalSkipped,
          ((int) elapsed_seconds) / 60, ((int) elapsed_seconds) % 60, 
          ((int) estimated_seconds) / 60, ((int) estimated_seconds) % 60,
          rate, rate_suffix);
+  int retry = retryTime();
+  if(retry > 0)
+    printf(", %02d:%02d more to retry", retry / 60, retry % 60);
   fflush(stdout);
 }
 
+void Progress::showProgress()
+{
+  Trace::nameThread("progress");
+  FlightRecorder::threadStarted();
+  std::unique_lock<std::mutex> lock(displayMutex);
+  std::chrono::duration<double> period(1/refreshRate);
+  while(! displayDone) {
+    displayCondition.wait_for(lock, period);
+    update();
+    writeCurrentProgress();
+    if(EventLog::enabled())
+      EventLog::emit(EventLog::Event("progress").
+                     set("sectors", (int) sectorsDone).
+                     set("total", totalSectors).
+                     set("skipped", (int) totalSkipped).
+                     set("rate", rate()).
+                     set("remaining", remainingTime()).
+                     set("retry", retryTime()));
+    if(onUpdate)
+      onUpdate(*this);
+  }
+}
+
+void Progress::startDisplay()
+{
+  stopDisplay();
+  if(refreshRate <= 0)
+    return;
+  displayDone = false;
+  display = std::thread(&Progress::showProgress, this);
+}
+
+void Progress::stopDisplay()
+{
+  if(! display.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(displayMutex);
+    displayDone = true;
+  }
+  displayCondition.notify_all();
+  display.join();
+}
+
+/// Shows the progress of a pass for as long as it exists (see
+/// Progress::startDisplay()), and tells the event log when the pass
+/// starts and ends. The pass is reported as failed unless succeeded()
+/// was called.
+class ProgressDisplay {
+  Progress & progress;
+  std::string phase;
+  std::string drive;
+  bool success;
+public:
+  /// Shows the progress of the pass @a ph from @a source to @a
+  /// target. The @a dr is the name of the source in the metrics.
+  ProgressDisplay(Progress & p, const std::string & ph, 
+                  const std::string & source, const std::string & target,
+                  const std::string & dr) :
+    progress(p), phase(ph), drive(dr), success(false) {
+    Metrics::setPhase(drive, phase);
+    FlightRecorder::record(FlightRecorder::PhaseStart, NULL, 0, 
+                           progress.totalSectors, 0, phase.c_str());
+    if(EventLog::enabled())
+      EventLog::emit(EventLog::Event("phase-start").
+                     set("phase", phase).
+                     set("source", source).
+                     set("target", target).
+                     set("total", progress.totalSectors));
+    progress.startDisplay();
+  };
+
+  /// Tells that the pass went to its end
+  void succeeded() {
+    success = true;
+  };
+
+  ~ProgressDisplay() {
+    progress.stopDisplay();
+    if(Progress::refreshRate <= 0) {
+      progress.update();
+      progress.writeCurrentProgress();
+    }
+    if(EventLog::enabled())
+      EventLog::emit(EventLog::Event("phase-end").
+                     set("phase", phase).
+                     set("status", success ? "done" : "failed").
+                     set("sectors", (int) progress.sectorsDone).
+                     set("skipped", (int) progress.totalSkipped));
+    FlightRecorder::record(FlightRecorder::PhaseEnd, NULL, 0, 
+                           progress.sectorsDone, 0, phase.c_str());
+    Metrics::setPhase(drive, "idle");
+  };
+};
+
 
 
 //////////////////////////////////////////////////////////////////////
 
 
-DVDCopy::DVDCopy() : reader(NULL),
-                     badSectors(NULL), skipBUP(false),
+DVDCopy::DVDCopy() : badSectors(NULL), passName("copy"),
+                     skipBUP(false),
                      sectorsRead(-1),
-                     backwards(false)
+                     backwards(false), maxAttempts(-1),
+                     interleave(1), retries(0), mapOutput(false),
+                     directAccess(true), jobs(0), queueDepth(0),
+                     recordSurface(false), replaySpeed(0),
+                     validatePacks(false)
 {
 }
 
 #define STANDARD_READ 128
 
+/// The number of sectors copied at once when the source files can
+/// be accessed directly.
+#define DIRECT_COPY_CHUNK 8192
+
 
 int DVDCopy::copyFile(const DVDFileData * dat, int firstBlock, 
                       int blockNumber, int readNumber)
@@ -207,6 +405,10 @@ int DVDCopy::copyFile(const DVDFileData * dat, int firstBlock,
       std::cout << "Hardlinking " 
                 << target << " to " << source << std::endl;
       link(source.c_str(), target.c_str());
+      if(EventLog::enabled())
+        EventLog::emit(EventLog::Event("file-linked").
+                       set("file", dat->fileName(true)).
+                       set("to", dat->dup->fileName(true)));
     }
     else {
       struct stat stold;
@@ -243,31 +445,16 @@ int DVDCopy::copyFile(const DVDFileData * dat, int firstBlock,
     extractIFOSizes(dat, &ifoSectors);
   
 
-  std::unique_ptr<DVDFile> file(DVDFile::openFile(reader, dat));
+  DVDFile * file = openFile(dat);
   if(! file) {
     std::string fileName = dat->fileName(true);
     printf("\nSkipping file %s (not found)\n", fileName.c_str());
+    if(EventLog::enabled())
+      EventLog::emit(EventLog::Event("file-missing").set("file", fileName));
     return 0;
   }
   DVDOutFile outfile(targetDirectory.c_str(), dat->title, dat->domain);
-
-  int skipped = 0;
-  auto success = [&outfile, this](int offset, int nb, 
-                            unsigned char * buffer,
-                            const DVDFileData * dat) {
-    outfile.writeSectors(reinterpret_cast<char*>(buffer), nb);
-    clearBadSectors(dat, offset, nb);
-    overallProgress.successfulRead(dat, nb);
-    overallProgress.writeCurrentProgress(dat);
-  };
-
-  auto failure = [&outfile, &skipped, this](int blk, int nb, 
-                                            const DVDFileData * dat) {
-    outfile.skipSectors(nb);
-    registerBadSectors(dat, blk, nb);
-    overallProgress.failedRead(dat, nb);
-    overallProgress.writeCurrentProgress(dat);
-  };
+  outfile.useMap = mapOutput;
 
   int size = file->fileSize();
   /// @todo make that configurable
@@ -277,50 +464,221 @@ int DVDCopy::copyFile(const DVDFileData * dat, int firstBlock,
            ifoSectors, size, fileName.c_str());
     size = ifoSectors;
   }
+  outfile.finalSize = size;
   int current_size = outfile.fileSize();
   printf("Current size of file %d, %d, %d\n", current_size, size, firstBlock);
   if(firstBlock > 0)
     current_size = firstBlock; 
+  FlightRecorder::record(FlightRecorder::File, dat, current_size, size);
+  if(EventLog::enabled())
+    EventLog::emit(EventLog::Event("file-start").
+                   set("file", dat->fileName(true)).
+                   set("size", size).
+                   set("start", current_size));
 
   if(current_size == size) {
     printf("File already fully read: not reading again\n");
+    if(EventLog::enabled())
+      EventLog::emit(EventLog::Event("file-end").
+                     set("file", dat->fileName(true)).
+                     set("skipped", 0));
+    std::lock_guard<std::mutex> lock(stateMutex);
     overallProgress.finishedFile(dat);
     return 0;
   }
   if(blockNumber < 0)
     blockNumber = size - current_size;
 
-  outfile.seek(current_size);
-
-  file->walkFile(current_size, blockNumber, readNumber, 
-                 success, failure);
+  int skipped = copySectors(file, outfile, dat, 
+                            current_size, blockNumber, readNumber);
 
   outfile.closeFile(); 
   if(skipped) {
     printf("\nThere were %d sectors skipped in this title set\n",
            skipped);
   }
+  if(EventLog::enabled())
+    EventLog::emit(EventLog::Event("file-end").
+                   set("file", dat->fileName(true)).
+                   set("skipped", skipped));
   
+  std::lock_guard<std::mutex> lock(stateMutex);
   overallProgress.finishedFile(dat);
   return skipped;
 }
 
-void DVDCopy::setup(const char *device, const char * target)
+/// The stage of the pipelines that keeps track of the bad sectors
+/// and of the progress.
+class DVDCopy::Accounting {
+  DVDCopy * copy;
+  const DVDFile * file;
+  bool clear;
+  bool dontWrite;
+  bool showProgress;
+  Metrics::Drive * metrics;
+public:
+  /// Accounts for the reads from @a f. The sectors read are removed
+  /// from the bad sectors if @a c is true, the bad sectors file is
+  /// written unless @a d is true, and the progress is updated if @a
+  /// p is true.
+  Accounting(DVDCopy * cp, const DVDFile * f, bool c = true, 
+             bool d = false, bool p = true) :
+    copy(cp), file(f), clear(c), dontWrite(d), showProgress(p), 
+    metrics(NULL) {
+    if(Metrics::enabled())
+      metrics = &Metrics::drive(copy->metricsDevice());
+  };
+
+  template<class Next>
+  void sectorsRead(int offset, int nb, unsigned char * buffer,
+                   const DVDFileData * dat, Next & next) {
+    // The output limit must not slow down the drives
+    if(DVDOutFile::rateLimiter && ! copy->source->isSeekFree())
+      DVDOutFile::rateLimiter->reportRead(copy->source.get(), nb * 2048,
+                                          file->lastReadDuration());
+    if(clear) {
+      std::lock_guard<std::mutex> lock(copy->stateMutex);
+      copy->clearBadSectors(dat, offset, nb, file->lastReadDuration(),
+                            dontWrite);
+    }
+    if(showProgress)
+      copy->overallProgress.successfulRead(dat, nb);
+    copy->recordReads(dat, offset, nb, file->lastReadDuration(), true);
+    FlightRecorder::record(FlightRecorder::Read, dat, offset, nb,
+                           file->lastReadDuration());
+    if(metrics) {
+      metrics->read += nb;
+      metrics->readLatency.observe(file->lastReadDuration());
+    }
+    if(EventLog::enabled())
+      EventLog::emit(EventLog::Event("read").
+                     set("file", dat->fileName(true)).
+                     set("sector", offset).
+                     set("sectors", nb).
+                     set("latency", file->lastReadDuration()));
+    next.sectorsRead(offset, nb, buffer, dat);
+  };
+
+  template<class Next>
+  void sectorsFailed(int offset, int nb, ReadAttempt::Outcome outcome,
+                     const DVDFileData * dat, Next & next) {
+    {
+      std::lock_guard<std::mutex> lock(copy->stateMutex);
+      copy->registerBadSectors(dat, offset, nb, file->lastReadDuration(),
+                               outcome, dontWrite);
+    }
+    if(showProgress)
+      copy->overallProgress.failedRead(dat, nb, file->lastReadDuration());
+    copy->recordReads(dat, offset, nb, file->lastReadDuration(), false);
+    FlightRecorder::record(FlightRecorder::Error, dat, offset, nb,
+                           file->lastReadDuration(),
+                           ReadAttempt::outcomeName(outcome));
+    if(metrics) {
+      metrics->skipped += nb;
+      metrics->readLatency.observe(file->lastReadDuration());
+    }
+    if(EventLog::enabled())
+      EventLog::emit(EventLog::Event("error").
+                     set("file", dat->fileName(true)).
+                     set("sector", offset).
+                     set("sectors", nb).
+                     set("outcome", ReadAttempt::outcomeName(outcome)).
+                     set("latency", file->lastReadDuration()));
+    next.sectorsFailed(offset, nb, outcome, dat);
+  };
+
+  template<class Next>
+  unsigned char * readBuffer(int offset, int nb, Next & next) {
+    return next.readBuffer(offset, nb);
+  };
+};
+
+int DVDCopy::copySectors(DVDFile * file, DVDOutFile & outfile,
+                         const DVDFileData * dat, 
+                         int start, int nb, int steps)
 {
-  DVDReader r(device);
-  sourceDevice = device;
-  files = r.listFiles();
+  OutputStage output(outfile);
+  Accounting accounting(this, file);
+
+  outfile.seek(start);
+  overallProgress.showFile(file);
+  file->positionSize = start + nb;
+
+  // The VOB sectors read are checked as they are, like during a
+  // scan, so that a single read pass both copies and scans the
+  // disc. With validatePacks, they are read even when they could be
+  // copied without reading them.
+  bool validate = ! dat->isIFO();
+
+  // Files that can be accessed directly are copied without reading
+  // them, by chunks to show the progress. Whatever could not be
+  // copied is read normally.
+  int done = 0;
+  while(done < nb && ! (validate && validatePacks)) {
+    int chunk = std::min(nb - done, DIRECT_COPY_CHUNK);
+    file->position = start + done;
+    int copied = file->copySectorsTo(outfile, start + done, chunk);
+    if(copied > 0) {
+      {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        clearBadSectors(dat, start + done, copied, file->lastReadDuration());
+      }
+      overallProgress.successfulRead(dat, copied);
+      recordReads(dat, start + done, copied, file->lastReadDuration(), true);
+      FlightRecorder::record(FlightRecorder::Read, dat, start + done, copied,
+                             file->lastReadDuration());
+      if(Metrics::enabled())
+        Metrics::drive(metricsDevice()).read += copied;
+      if(EventLog::enabled())
+        EventLog::emit(EventLog::Event("read").
+                       set("file", dat->fileName(true)).
+                       set("sector", start + done).
+                       set("sectors", copied).
+                       set("latency", file->lastReadDuration()));
+    }
+    done += copied;
+    if(copied < chunk)
+      break;
+  }
+  if(done < nb) {
+    if(validate) {
+      // Invalid packs are skipped, and retried by the second pass
+      PackValidator validator;
+      auto pipeline = makePipeline(validator, output, accounting);
+      file->walkFile(start + done, nb - done, steps, pipeline);
+    }
+    else {
+      auto pipeline = makePipeline(output, accounting);
+      file->walkFile(start + done, nb - done, steps, pipeline);
+    }
+  }
+  return output.skipped;
+}
 
-  reader = DVDOpen(device);
-  if(! reader) {
-    std::string err("Error opening device ");
-    err += device;
-    throw std::runtime_error(err);
+void DVDCopy::setup(const char *device, const char * target)
+{
+  // When the same source is used for several operations in a row,
+  // we keep the reader and the opened files.
+  if(! source || source->device != device) {
+    files.clear();
+    otherSources.clear();
+    source.reset();
+    source.reset(new DVDSource(device));
+    source->directAccess = directAccess;
+    source->queueDepth = queueDepth;
+    if(! simulationSpec.empty())
+      source->simulateDrive(simulationSpec);
+    if(! sessionReplay.empty())
+      source->replaySession(sessionReplay, replaySpeed);
+    if(! sessionRecord.empty())
+      source->recordSession(sessionRecord);
+    files = source->files;
   }
 
   if(target) {
     char buf[1024];
     targetDirectory = target;
+    FlightRecorder::setDefaultFile(targetDirectory + ".flight");
     struct stat dummy;
     if(stat(target,&dummy)) {
       fprintf(stderr,"Creating directory %s\n", target);
@@ -339,43 +697,363 @@ void DVDCopy::setup(const char *device, const char * target)
 
 int DVDCopy::copy(const char *device, const char * target)
 {
+  passName = "copy";
   setup(device, target);
   overallProgress.setupForCopying(files);
+  loadSurfaceMap();
+  ProgressDisplay display(overallProgress, passName, device, target,
+                          metricsDevice());
+
+  int nb = copyJobs();
+  if(nb <= 1) {
+    /// Methodically copies all listed files
+    for(std::vector<DVDFileData *>::iterator i = files.begin(); 
+        i != files.end(); i++)
+      copyFile(*i);
+    if(DVDOutFile::rateLimiter)
+      DVDOutFile::rateLimiter->forget(source.get());
+    saveSurfaceMap();
+    display.succeeded();
+    return overallProgress.totalSkipped;
+  }
 
-  /// Methodically copies all listed files
-  for(std::vector<DVDFileData *>::iterator i = files.begin(); 
-      i != files.end(); i++)
-    copyFile(*i);
+  // Several files are copied at the same time, the largest first so
+  // that the workers finish together. The duplicates are linked
+  // afterwards, once the files they link to are there.
+  std::vector<const DVDFileData *> toCopy;
+  for(const DVDFileData * dat : files)
+    if(! dat->dup)
+      toCopy.push_back(dat);
+  std::stable_sort(toCopy.begin(), toCopy.end(), 
+                   [](const DVDFileData * a, const DVDFileData * b) {
+                     return a->size > b->size;
+                   });
+  nb = std::min(nb, (int) toCopy.size());
+  printf("Copying with %d workers\n", nb);
+
+  std::atomic<int> next(0);
+  std::vector<std::exception_ptr> errors(nb);
+  auto work = [this, &toCopy, &next, &errors](int job) {
+    if(job > 0) {
+      Trace::nameThread("copy worker " + std::to_string(job));
+      FlightRecorder::threadStarted();
+    }
+    try {
+      int i;
+      while((i = next++) < (int) toCopy.size())
+        copyFile(toCopy[i]);
+    }
+    catch(...) {
+      errors[job] = std::current_exception();
+      next = toCopy.size();     // Stop the others
+    }
+  };
+  std::vector<std::thread> threads;
+  for(int i = 1; i < nb; i++)
+    threads.push_back(std::thread(work, i));
+  work(0);
+  for(std::thread & t : threads)
+    t.join();
+  for(std::exception_ptr & e : errors)
+    if(e)
+      std::rethrow_exception(e);
+
+  for(const DVDFileData * dat : files)
+    if(dat->dup)
+      copyFile(dat);
+  if(DVDOutFile::rateLimiter)
+    DVDOutFile::rateLimiter->forget(source.get());
+  saveSurfaceMap();
+  display.succeeded();
   return overallProgress.totalSkipped;
 }
 
+int DVDCopy::copyJobs() const
+{
+  if(! source->isSeekFree())
+    return 1;
+  if(jobs > 0)
+    return jobs;
+  return std::max(1U, std::thread::hardware_concurrency());
+}
+
 void DVDCopy::secondPass(const char *device, const char * target)
 {
+  passName = "second-pass";
   setup(device, target);
+  setupOtherSources();
   readBadSectors();
-  overallProgress.setupForSecondPass(files, badSectors);
-
-  for(auto it = files.begin(); it != files.end(); ++it) {
-    const DVDFileData * file = *it;
-    std::set<int> bs = badSectors->badSectorsForFile(file);
-    if(backwards) {
-      for(auto it2 = bs.rbegin(); it2 != bs.rend(); ++it2)
-        copyFile(file, *it2, 1, 1);
+
+  // We retry first the sectors most likely to be recovered, across
+  // all files, using the history of the previous attempts, and then
+  // in the order that minimizes seeks.
+  RetryScheduler scheduler;
+  scheduler.backwards = backwards;
+  scheduler.interleave = interleave;
+  int hopeless = 0;
+  for(size_t i = 0; i < files.size(); i++) {
+    const DVDFileData * file = files[i];
+    // Same conditions as in copyFile()
+    if(file->dup || file->number > 1 || (skipBUP && file->isBackup()))
+      continue;
+    std::vector<std::pair<int, int> > sectors = 
+      badSectors->retryOrder(file, maxAttempts, backwards);
+    hopeless += badSectors->badSectorsForFile(file).size() - sectors.size();
+    for(const auto & s : sectors)
+      scheduler.addRetry(Retry(i, s.first, 
+                               source->physicalSector(file, s.first),
+                               s.second));
+  }
+  if(hopeless > 0)
+    printf("Not retrying %d sectors that already failed %d times\n",
+           hopeless, maxAttempts);
+  std::vector<Retry> schedule = scheduler.schedule();
+
+  overallProgress.setupForSecondPass(files, schedule);
+  loadSurfaceMap();
+  ProgressDisplay display(overallProgress, passName, device, target,
+                          metricsDevice());
+
+  // The output files stay open for the whole pass (as do the input
+  // ones), and contiguous bad sectors are read in one go, sector by
+  // sector. When there are several sources, each of them works in
+  // its own thread, and tries the sectors the others could not read.
+  std::map<int, std::unique_ptr<DVDOutFile> > opened;
+  SharedRetryQueue queue(schedule, otherSources.size() + 1);
+
+  std::vector<std::exception_ptr> errors(otherSources.size());
+  std::vector<std::thread> threads;
+  for(size_t i = 0; i < otherSources.size(); i++)
+    threads.push_back(std::thread([this, i, &queue, &opened, &errors]() {
+          Trace::nameThread("source " + otherSources[i]->device);
+          FlightRecorder::threadStarted();
+          try {
+            recoverSectors(i + 1, otherSources[i].get(), queue, opened);
+          }
+          catch(...) {
+            errors[i] = std::current_exception();
+            queue.abort();
+          }
+        }));
+
+  try {
+    recoverSectors(0, source.get(), queue, opened);
+  }
+  catch(...) {
+    queue.abort();
+    for(std::thread & t : threads)
+      t.join();
+    throw;
+  }
+  for(std::thread & t : threads)
+    t.join();
+  for(std::exception_ptr & e : errors)
+    if(e)
+      std::rethrow_exception(e);
+
+  for(auto it = opened.begin(); it != opened.end(); ++it) {
+    it->second->closeFile();
+    overallProgress.finishedFile(files[it->first]);
+  }
+  retryStrategy.writeSummary();
+  saveSurfaceMap();
+  display.succeeded();
+}
+
+/// The stage of the second pass that writes the sectors read by one
+/// of the sources, and reports them to the shared queue. As the
+/// sources work in parallel, everything is done with the state mutex
+/// held.
+class DVDCopy::Recovery {
+  DVDCopy * copy;
+  int drive;
+  DVDSource * source;
+  SharedRetryQueue & queue;
+  int index;
+  const DVDFileData * dat;
+  const DVDFile * input;
+  DVDOutFile * output;
+  Metrics::Drive * metrics;
+public:
+
+  Recovery(DVDCopy * cp, int d, DVDSource * src, SharedRetryQueue & q,
+           int idx, const DVDFile * in, DVDOutFile * out) :
+    copy(cp), drive(d), source(src), queue(q), index(idx),
+    dat(cp->files[idx]), input(in), output(out), metrics(NULL) {
+    if(Metrics::enabled())
+      metrics = &Metrics::drive(copy->metricsDevice(source));
+  };
+
+  /// Reports the outcome of the sectors to the queue. The sectors the
+  /// queue gives up are skipped for good. The state mutex must be
+  /// held.
+  void finish(int blk, int nb, bool success) {
+    int givenUp = 0;
+    for(int i = 0; i < nb; i++)
+      if(queue.finish(drive, index, blk + i, success))
+        ++givenUp;
+    if(givenUp > 0) {
+      FlightRecorder::record(FlightRecorder::GivenUp, dat, blk, givenUp);
+      copy->overallProgress.failedRead(dat, givenUp);
+      if(EventLog::enabled())
+        EventLog::emit(EventLog::Event("given-up").
+                       set("file", dat->fileName(true)).
+                       set("sector", blk).
+                       set("sectors", givenUp));
+    }
+  };
+
+  /// Tells the event log and the metrics about the outcome of reading
+  /// the sectors
+  void retryEvent(int blk, int nb, ReadAttempt::Outcome outcome) {
+    // The map is about the main drive
+    if(drive == 0)
+      copy->recordReads(dat, blk, nb, input->lastReadDuration(),
+                        outcome == ReadAttempt::Success);
+    FlightRecorder::record(outcome == ReadAttempt::Success ? 
+                           FlightRecorder::Recovered : 
+                           FlightRecorder::Retry, dat, blk, nb,
+                           input->lastReadDuration(), 
+                           source->device.c_str());
+    if(metrics) {
+      metrics->retried += nb;
+      if(outcome == ReadAttempt::Success)
+        metrics->recovered += nb;
+      metrics->readLatency.observe(input->lastReadDuration());
+    }
+    if(EventLog::enabled())
+      EventLog::emit(EventLog::Event("retry").
+                     set("file", dat->fileName(true)).
+                     set("sector", blk).
+                     set("sectors", nb).
+                     set("source", source->device).
+                     set("outcome", ReadAttempt::outcomeName(outcome)).
+                     set("latency", input->lastReadDuration()));
+  };
+
+  template<class Next>
+  void sectorsRead(int offset, int nb, unsigned char * buffer,
+                   const DVDFileData *, Next & next) {
+    {
+      std::lock_guard<std::mutex> lock(copy->stateMutex);
+      finish(offset, nb, true);
+      output->seek(offset);
+      output->writeSectors(reinterpret_cast<char*>(buffer), nb);
+      copy->badSectors->
+        registerSuccess(dat, offset, nb, 
+                        copy->currentAttempt(ReadAttempt::Success,
+                                             input->lastReadDuration(),
+                                             source));
+      copy->badSectors->writeOut();
+      copy->overallProgress.successfulRead(dat, nb);
+    }
+    retryEvent(offset, nb, ReadAttempt::Success);
+    next.sectorsRead(offset, nb, buffer, dat);
+  };
+
+  template<class Next>
+  void sectorsFailed(int offset, int nb, ReadAttempt::Outcome outcome,
+                     const DVDFileData *, Next & next) {
+    {
+      std::lock_guard<std::mutex> lock(copy->stateMutex);
+      copy->badSectors->
+        registerFailure(dat, offset, nb, 
+                        copy->currentAttempt(outcome,
+                                             input->lastReadDuration(),
+                                             source));
+      copy->badSectors->writeOut();
+      finish(offset, nb, false);
+    }
+    retryEvent(offset, nb, outcome);
+    next.sectorsFailed(offset, nb, outcome, dat);
+  };
+
+  /// The output file is shared, so the sectors are not read directly
+  /// into it.
+  template<class Next>
+  unsigned char * readBuffer(int, int, Next &) {
+    return NULL;
+  };
+};
+
+void DVDCopy::recoverSectors(int drive, DVDSource * src,
+                             SharedRetryQueue & queue,
+                             std::map<int, std::unique_ptr<DVDOutFile> > & 
+                             outputs)
+{
+  // Each source has its own statistics about the retries, since they
+  // depend on the drive. Only those of the main source are kept.
+  RetryStrategy own(retryStrategy.distance, retryStrategy.size);
+  RetryStrategy * strategy = (drive == 0 ? &retryStrategy : &own);
+  if(drive > 0)
+    Metrics::setPhase(metricsDevice(src), passName);
+
+  int idx, start, nb;
+  while(queue.nextRun(drive, &idx, &start, &nb)) {
+    const DVDFileData * dat = files[idx];
+
+    DVDFile * input = src->openFile(src->files[idx]);
+    if(! input) {
+      std::lock_guard<std::mutex> lock(stateMutex);
+      std::string fileName = dat->fileName(true);
+      printf("\nSkipping file %s (not found on %s)\n", fileName.c_str(),
+             src->device.c_str());
+      Recovery(this, drive, src, queue, idx, NULL, NULL).
+        finish(start, nb, false);
+      continue;
+    }
+
+    DVDOutFile * output;
+    {
+      std::lock_guard<std::mutex> lock(stateMutex);
+      std::unique_ptr<DVDOutFile> & out = outputs[idx];
+      if(! out)
+        out.reset(new DVDOutFile(targetDirectory.c_str(), 
+                                 dat->title, dat->domain));
+      output = out.get();
+    }
+
+    Recovery recovery(this, drive, src, queue, idx, input, output);
+    input->retries = retries;
+    input->retryStrategy = strategy;
+    overallProgress.showFile(input);
+    Trace::Span span("retry", "retry");
+    if(Trace::enabled())
+      span.set("file", dat->fileName(true)).set("sector", start).
+        set("sectors", nb).set("source", src->device);
+    if(dat->isIFO()) {
+      auto pipeline = makePipeline(recovery);
+      input->walkFile(start, nb, 1, pipeline);
     }
     else {
-      for(auto it2 = bs.begin(); it2 != bs.end(); ++it2)
-        copyFile(file, *it2, 1, 1);
+      // As in copySectors(), so that invalid packs stay bad sectors
+      PackValidator validator;
+      auto pipeline = makePipeline(validator, recovery);
+      input->walkFile(start, nb, 1, pipeline);
     }
+    input->retries = 0;
+    input->retryStrategy = NULL;
+  }
+
+  if(drive > 0) {
+    Metrics::setPhase(metricsDevice(src), "idle");
+    std::lock_guard<std::mutex> lock(stateMutex);
+    own.writeSummary(src->device);
   }
 }
 
-void DVDCopy::scanForBadSectors(const char *device, 
-                                const char * badSectorsFile)
+int DVDCopy::scanForBadSectors(const char *device, 
+                               const char * badSectorsFile)
 {
+  passName = "scan";
   setup(device, NULL);
   setBadSectorsFileName(badSectorsFile);
+  FlightRecorder::setDefaultFile(std::string(badSectorsFile) + ".flight");
   badSectors->clear();
   overallProgress.setupForCopying(files);
+  loadSurfaceMap();
+  ProgressDisplay display(overallProgress, passName, device, 
+                          badSectorsFile, metricsDevice());
   
 
   for(std::vector<DVDFileData *>::iterator i = files.begin(); 
@@ -386,41 +1064,144 @@ void DVDCopy::scanForBadSectors(const char *device,
     if(dat->domain == DVD_READ_INFO_FILE ||
        dat->domain == DVD_READ_INFO_BACKUP_FILE)
       continue;
-    std::unique_ptr<DVDFile> file(DVDFile::openFile(reader, dat));
+    DVDFile * file = openFile(dat);
     int sz = file->fileSize();
 
-    auto success = [this](int blk, int nb, 
-                      unsigned char * buf,
-                      const DVDFileData * dat) {
-      for(int i = 0; i < nb; i++) {
-        unsigned char * buffer = buf + i * 2048;
-        int first_pes_offset = 13 + (buffer[13] & 0x7);
-        if(buffer[2] == 1 && buffer[first_pes_offset + 3] == 1)
-          overallProgress.successfulRead(dat, 1);
-        else {
-          overallProgress.failedRead(dat, 1);
-          registerBadSectors(dat, blk + i, 1, true);
-        }
-      }
-      overallProgress.writeCurrentProgress(dat);
-    };
-
-    auto failure = [this](int blk, int nb, 
-                      const DVDFileData * dat) {
-      registerBadSectors(dat, blk, nb, true);
-      overallProgress.failedRead(dat, nb);
-      overallProgress.writeCurrentProgress(dat);
-    };
-
+    // Invalid packs count as bad sectors
+    PackValidator validator;
+    Accounting accounting(this, file, false, true);
+    auto pipeline = makePipeline(validator, accounting);
+    overallProgress.showFile(file);
+    FlightRecorder::record(FlightRecorder::File, dat, 0, sz);
+    if(EventLog::enabled())
+      EventLog::emit(EventLog::Event("file-start").
+                     set("file", dat->fileName(true)).
+                     set("size", sz).
+                     set("start", 0));
+    int before = overallProgress.totalSkipped;
     file->walkFile(0, sz, (sectorsRead > 0 ? sectorsRead : -1), 
-                   success, failure);
+                   pipeline);
+    if(EventLog::enabled())
+      EventLog::emit(EventLog::Event("file-end").
+                     set("file", dat->fileName(true)).
+                     set("skipped", overallProgress.totalSkipped - before));
   }
   
   badSectors->writeOut();
+  saveSurfaceMap();
+  display.succeeded();
+  return overallProgress.totalSkipped;
+}
+
+int DVDCopy::verify(const char * device, const char * target)
+{
+  passName = "verify";
+  setup(device, NULL);
+  DVDSource copy(target);
+  BadSectorsFile bad(std::string(target) + ".bad");
+  if(EventLog::enabled())
+    EventLog::emit(EventLog::Event("phase-start").
+                   set("phase", passName).
+                   set("source", device).
+                   set("target", target));
+  Metrics::setPhase(metricsDevice(), passName);
+
+  SectorBuffer in = SectorArena::global().allocate(STANDARD_READ);
+  SectorBuffer out = SectorArena::global().allocate(STANDARD_READ);
+  int total = 0;
+  for(const DVDFileData * dat : files) {
+    if(dat->dup || dat->number > 1)
+      continue;
+    if(skipBUP && dat->isBackup())
+      continue;
+    std::string fileName = dat->fileName(true);
+    DVDFile * input = openFile(dat);
+    if(! input)
+      continue;
+    const DVDFileData * other = NULL;
+    for(const DVDFileData * f : copy.files)
+      if(f->title == dat->title && f->domain == dat->domain && 
+         f->number == dat->number)
+        other = f;
+    DVDFile * file = (other ? copy.openFile(other) : NULL);
+    if(! file) {
+      printf("%s: missing in the copy\n", fileName.c_str());
+      if(EventLog::enabled())
+        EventLog::emit(EventLog::Event("file-missing").set("file", fileName));
+      total += input->fileSize();
+      continue;
+    }
+
+    // Only the sectors the IFO headers talk about are copied (see
+    // copyFile())
+    int size = input->fileSize();
+    int ifoSectors = -1;
+    if(dat->isIFO())
+      extractIFOSizes(dat, &ifoSectors);
+    if(ifoSectors > 0 && size > ifoSectors)
+      size = ifoSectors;
+
+    std::set<int> skipped = bad.badSectorsForFile(dat);
+    int differ = 0;
+    for(int blk = 0; blk < size; blk += STANDARD_READ) {
+      int nb = std::min(size - blk, STANDARD_READ);
+      printf("\r%s: %7d/%d", fileName.c_str(), blk, size);
+      int rs = input->readBlocks(blk, nb, in.data());
+      int rc = file->readBlocks(blk, nb, out.data());
+      for(int i = 0; i < nb; i++) {
+        if(skipped.count(blk + i))
+          continue;
+        if(i >= rs || i >= rc || memcmp(in.sector(i), out.sector(i), 2048))
+          ++differ;
+      }
+    }
+    printf("\r%s: %d sectors, %d differ\n", fileName.c_str(), size, differ);
+    if(EventLog::enabled())
+      EventLog::emit(EventLog::Event("file-end").
+                     set("file", fileName).
+                     set("size", size).
+                     set("differ", differ));
+    total += differ;
+  }
+  if(EventLog::enabled())
+    EventLog::emit(EventLog::Event("phase-end").
+                   set("phase", passName).
+                   set("status", "done").
+                   set("differ", total));
+  Metrics::setPhase(metricsDevice(), "idle");
+  return total;
+}
+
+std::string DVDCopy::metricsDevice(const DVDSource * src) const
+{
+  if(! src || src == source.get())
+    return metricsName.empty() ? source->device : metricsName;
+  return src->device;
+}
+
+void DVDCopy::copyOptions(const DVDCopy & other)
+{
+  skipBUP = other.skipBUP;
+  sectorsRead = other.sectorsRead;
+  backwards = other.backwards;
+  maxAttempts = other.maxAttempts;
+  interleave = other.interleave;
+  retries = other.retries;
+  retryStrategy.distance = other.retryStrategy.distance;
+  retryStrategy.size = other.retryStrategy.size;
+  mapOutput = other.mapOutput;
+  directAccess = other.directAccess;
+  queueDepth = other.queueDepth;
+  jobs = other.jobs;
+  recordSurface = other.recordSurface;
+  validatePacks = other.validatePacks;
+  simulationSpec = other.simulationSpec;
+  // The sessions are specific to one source, they are not taken over
 }
 
 void DVDCopy::spliceIFO(const char * device, const char * target, int nb)
 {
+  passName = "splice";
   setup(device, target);
 
 
@@ -457,57 +1238,98 @@ void DVDCopy::spliceIFO(const char * device, const char * target, int nb)
     extractIFOSizes(ifo, &ifoSectors);
     DVDOutFile outfile(targetDirectory.c_str(), 
                        ifo->title, ifo->domain);
-    std::unique_ptr<DVDFile> file(DVDFile::openFile(reader, bup));
-
-    int skipped = 0;
-    auto success = [&outfile](int offset, int nb, 
-                              unsigned char * buffer,
-                              const DVDFileData * dat) {
-      outfile.writeSectors(reinterpret_cast<char*>(buffer), nb);
-    };
-
-    auto failure = [&outfile, &skipped, this](int blk, int nb, 
-                                              const DVDFileData * dat) {
-      outfile.skipSectors(nb);
-      registerBadSectors(dat, blk, nb);
-      skipped += nb;
-    };
+    DVDFile * file = openFile(bup);
+
+    OutputStage output(outfile);
+    Accounting accounting(this, file, false, false, false);
+    auto pipeline = makePipeline(output, accounting);
 
     outfile.seek(nb);
-    file->walkFile(nb, ifoSectors - nb, 128, 
-                   success, failure);
+    file->walkFile(nb, ifoSectors - nb, 128, pipeline);
   }
 }
 
 
+DVDFile * DVDCopy::openFile(const DVDFileData * dat)
+{
+  return source->openFile(dat);
+}
+
+void DVDCopy::setupOtherSources()
+{
+  if(otherSources.size() == otherDevices.size())
+    return;                     // Already done
+  otherSources.clear();
+  std::string reference = source->fingerprint();
+  for(size_t i = 0; i < otherDevices.size(); i++) {
+    std::unique_ptr<DVDSource> src(new DVDSource(otherDevices[i].c_str()));
+    src->directAccess = directAccess;
+    src->queueDepth = queueDepth;
+    if(! simulationSpec.empty())
+      src->simulateDrive(simulationSpec, i + 1);
+    if(src->fingerprint() != reference) {
+      std::string err = "The disc in " + otherDevices[i] + 
+        " is not the same as the one in " + source->device;
+      throw std::runtime_error(err);
+    }
+    printf("Using %s as an additional source\n", otherDevices[i].c_str());
+    otherSources.push_back(std::move(src));
+  }
+}
+
+void DVDCopy::addSource(const char * device)
+{
+  otherDevices.push_back(device);
+}
+
 DVDCopy::~DVDCopy()
 {
-  if(reader)
-    DVDClose(reader);
+  // In case the copy failed
+  if(DVDOutFile::rateLimiter)
+    DVDOutFile::rateLimiter->forget(source.get());
+  try {
+    saveSurfaceMap();
+  }
+  catch(const std::exception & e) {
+    fprintf(stderr, "%s\n", e.what());
+  }
   delete badSectors;
-  for(std::vector<DVDFileData *>::iterator i = files.begin(); 
-      i != files.end(); i++)
-    delete *i;                  // Keep it clean;
+}
+
+ReadAttempt DVDCopy::currentAttempt(ReadAttempt::Outcome outcome,
+                                    double latency, const DVDSource * src)
+{
+  if(! src)
+    src = source.get();
+  struct timeval current;
+  gettimeofday(&current, NULL);
+  return ReadAttempt(outcome, current.tv_sec + 1e-6 * current.tv_usec,
+                     latency, passName + "@" + src->device);
 }
 
 void DVDCopy::registerBadSectors(const DVDFileData * dat, 
-                                 int beg, int size, bool dontWrite)
+                                 int beg, int size, double latency,
+                                 ReadAttempt::Outcome outcome,
+                                 bool dontWrite)
 {
   if(! badSectors) {
     std::string bsf = targetDirectory + ".bad";
     badSectors = new BadSectorsFile(bsf);
   }
-  badSectors->markBadSectors(dat, beg, size);
+  badSectors->registerFailure(dat, beg, size, 
+                              currentAttempt(outcome, latency));
   if(! dontWrite)
     badSectors->writeOut();
 }
 
 void DVDCopy::clearBadSectors(const DVDFileData * dat, 
-                              int beg, int size, bool dontWrite)
+                              int beg, int size, double latency,
+                              bool dontWrite)
 {
   if(! badSectors)
     return;
-  badSectors->clearBadSectors(dat, beg, size);
+  badSectors->registerSuccess(dat, beg, size, 
+                              currentAttempt(ReadAttempt::Success, latency));
   if(! dontWrite)
     badSectors->writeOut();
 }
@@ -523,11 +1345,42 @@ void DVDCopy::readBadSectors()
 void DVDCopy::setBadSectorsFileName(const char * file)
 {
   delete badSectors;
+  badSectorsFileName = file;
   std::cout << "Using '" << badSectorsFileName << "' for bad sectors " 
             << std::endl;
   badSectors = new BadSectorsFile(file);
 }
 
+std::string DVDCopy::surfaceMapFileName() const
+{
+  if(badSectorsFileName.empty())
+    return targetDirectory + ".bad.map";
+  return badSectorsFileName + ".map";
+}
+
+void DVDCopy::loadSurfaceMap()
+{
+  if(! recordSurface)
+    return;
+  surface.reset(new SurfaceMap);
+  surface->load(surfaceMapFileName());
+}
+
+void DVDCopy::saveSurfaceMap()
+{
+  if(! surface)
+    return;
+  std::unique_ptr<SurfaceMap> map(std::move(surface));
+  map->save(surfaceMapFileName());
+}
+
+void DVDCopy::recordReads(const DVDFileData * dat, int offset, int nb,
+                          double latency, bool success)
+{
+  if(surface)
+    surface->record(source->physicalSector(dat, offset), nb, 
+                    latency, success);
+}
 
 int DVDCopy::findFile(int title, dvd_read_domain_t domain, int number)
 {
@@ -543,18 +1396,40 @@ int DVDCopy::findFile(int title, dvd_read_domain_t domain, int number)
   return -1;
 }
 
+void DVDCopy::simulateDrive(const char * spec)
+{
+  simulationSpec = spec;
+  if(source)
+    source->simulateDrive(simulationSpec);
+}
+
+void DVDCopy::recordSession(const char * file)
+{
+  sessionRecord = file;
+  if(source)
+    source->recordSession(sessionRecord);
+}
+
+void DVDCopy::replaySession(const char * file)
+{
+  sessionReplay = file;
+  if(source)
+    source->replaySession(sessionReplay, replaySpeed);
+}
+
 void DVDCopy::ejectDrive()
 {
-  if(! sourceDevice.empty())
-    DVDDrive::eject(sourceDevice.c_str());
+  if(source)
+    DVDDrive::eject(source->device.c_str());
 }
 
 void DVDCopy::extractIFOSizes(const DVDFileData * dat, 
                               int * ifoSectors,
                               int * titleSectors)
 {
-  unsigned char buffer[2048];
-  std::unique_ptr<DVDFile> file(DVDFile::openFile(reader, dat));
+  SectorBuffer sector = SectorArena::global().allocate(1);
+  unsigned char * buffer = sector.data();
+  DVDFile * file = openFile(dat);
 
   // Read the first sector
   file->readBlocks(0, 1, buffer);
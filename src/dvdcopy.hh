@@ -21,12 +21,21 @@
 #define __DVDCOPY_H
 
 #include "dvdreader.hh"
+#include "badsectors.hh"
+#include "retryscheduler.hh"
+#include "dvdsource.hh"
+#include "surfacemap.hh"
 
-class BadSectorsFile;
+class DVDFile;
+class DVDOutFile;
 
 
 /// This class represents the total progress for a copy (or re-read)
-/// operation
+/// operation.
+///
+/// The counters are atomic, so that the threads reading can update
+/// them without locking, and the progress is shown by a separate
+/// thread, at most refreshRate times per second (see startDisplay()).
 class Progress {
 protected:
 
@@ -37,49 +46,138 @@ protected:
     int totalSectors;
     
     /// The number of sectors already read in this file
-    int sectorsDone;
+    std::atomic<int> sectorsDone;
     
     /// The number of skipped sectors in this file
-    int skippedSectors;
+    std::atomic<int> skippedSectors;
 
   };
 
-  std::map<const DVDFileData *, FileProgress> progresses;
+  /// The progress of the files, indexed by DVDFileData::index
+  std::unique_ptr<FileProgress[]> progresses;
 
+  /// The number of elements of progresses
+  int nbFiles;
+
+  /// Returns the progress of the given file
+  FileProgress & fileProgress(const DVDFileData * file) const;
+
+  /// Allocates the progresses for the given files
+  void setupFiles(const std::vector<DVDFileData * > & files);
 
   /// Time at which the reading process started.
-  struct timeval startTime;
+  std::chrono::steady_clock::time_point startTime;
+
+  /// The file whose progress is shown, if any
+  std::atomic<const DVDFile *> currentFile;
+
+  /// The thread showing the progress
+  std::thread display;
+
+  /// Protects the following, to wake up the display thread
+  std::mutex displayMutex;
+  std::condition_variable displayCondition;
+  bool displayDone;
+
+  /// Shows the progress until stopDisplay() is called
+  void showProgress();
+
+  /// Protects the estimates below
+  mutable std::mutex estimateMutex;
 
+  /// The average read rate, in sectors per second, over the last
+  /// RATE_WINDOW seconds or so, updated by update()
+  double averageRate;
+
+  /// When and where the average rate was last updated
+  std::chrono::steady_clock::time_point lastUpdate;
+  int lastDone;
+
+  /// The average duration of the reads that failed, in seconds, or
+  /// -1 if none failed yet
+  double failedLatency;
 
 public:
 
   int totalSectors;
-  int sectorsDone;
-  int totalSkipped;
+  std::atomic<int> sectorsDone;
+  std::atomic<int> totalSkipped;
+
+  /// The maximum number of times the progress is shown per second
+  static double refreshRate;
+
+  Progress();
 
   /// Sets up a progress report for a copy operation
   void setupForCopying(const std::vector<DVDFileData * > & files);
 
-  /// Sets up a progress report for a copy operation
+  /// Sets up a progress report for a second pass, in which the
+  /// given @a retries are done (see RetryScheduler).
   void setupForSecondPass(const std::vector<DVDFileData * > & files,
-                          BadSectorsFile * badSectors);
+                          const std::vector<Retry> & retries);
 
   void finishedFile(const DVDFileData * file);
 
   /// Advance the given file by that many sectors
   void successfulRead(const DVDFileData * file, int nb);
 
-  /// Advance the given file by that many skipped sectors
-  void failedRead(const DVDFileData * file, int nb);
+  /// Advance the given file by that many skipped sectors, whose read
+  /// took @a latency seconds (if known)
+  void failedRead(const DVDFileData * file, int nb, double latency = -1);
+
+  /// Updates the average rate, from the sectors done since the last
+  /// time. This is done by the display thread.
+  void update();
+
+  /// The current read rate, in bytes per second, averaged over the
+  /// last few seconds.
+  double rate() const;
 
-  /// Writes the current progress (for the given file, and for all)
-  void writeCurrentProgress(const DVDFileData * file) const;
+  /// The estimated time left for this operation, in seconds, or -1 if
+  /// it is not known yet.
+  double remainingTime() const;
+
+  /// The estimated time it will take to read again the sectors
+  /// skipped so far (in a second pass), in seconds, based on how long
+  /// the reads that failed took.
+  double retryTime() const;
+
+  /// If set, this is called by the display thread each time it shows
+  /// the progress.
+  std::function<void (const Progress &)> onUpdate;
+
+  /// Shows the progress of @a file from now on (see
+  /// DVDFile::position).
+  void showFile(const DVDFile * file) {
+    currentFile = file;
+  };
+
+  /// Writes the current progress (for the current file, and for all)
+  void writeCurrentProgress() const;
+
+  /// Starts the thread showing the progress (and updating the
+  /// estimates).
+  void startDisplay();
+
+  /// Stops the thread showing the progress, after it has shown the
+  /// final state.
+  void stopDisplay();
+
+  ~Progress();
 };
 
 
 
 /// Handles the actual copying job, from a source to a target.
 class DVDCopy {
+  /// The stage of the pipelines that keeps track of the bad sectors
+  /// and the progress (see Pipeline).
+  class Accounting;
+
+  /// The stage of the second pass pipeline that handles the sectors
+  /// read by one of the sources.
+  class Recovery;
+
   /// Copies one file.
   ///
   /// If specified, the @a start and @a nb parameters define the
@@ -93,12 +191,38 @@ class DVDCopy {
   int copyFile(const DVDFileData * dat, int start = 0, 
                int nb = -1, int readNumber = -1);
 
-  /// The DVD device we're reading
-  dvd_reader_t * reader;
+  /// Reads @a nb sectors starting from @a start from the @a file, by
+  /// reads of @a steps sectors, and writes them at the same position
+  /// in @a outfile, keeping track of the bad sectors and of the
+  /// progress.
+  ///
+  /// It returns the number of skipped sectors.
+  int copySectors(DVDFile * file, DVDOutFile & outfile,
+                  const DVDFileData * dat,
+                  int start, int nb, int steps);
+
+  /// The source we're reading
+  std::unique_ptr<DVDSource> source;
+
+  /// The additional sources, holding other copies of the same disc,
+  /// used during the second pass.
+  std::vector<std::unique_ptr<DVDSource> > otherSources;
+
+  /// The device names of the additional sources
+  std::vector<std::string> otherDevices;
+
+  /// The specification of the drive simulation (if not empty)
+  std::string simulationSpec;
+
+  /// The session logs in which the reads of the main source are
+  /// recorded, and from which they are replayed (if not empty).
+  std::string sessionRecord;
+  std::string sessionReplay;
+
+  /// Returns the opened DVDFile for the given file of the main source
+  /// (see DVDSource::openFile()).
+  DVDFile * openFile(const DVDFileData * dat);
 
-  /// The source device
-  std::string sourceDevice;
-  
   /// The target directory.
   std::string targetDirectory;
 
@@ -106,24 +230,62 @@ class DVDCopy {
 
   /// Writes a bad sector list to the bad sectors file (unless
   /// dontWrite is true), and add them to the badSectors list (in any
-  /// case).
+  /// case). The failure is recorded in the history of the sectors,
+  /// along with the @a latency of the read.
   void registerBadSectors(const DVDFileData * dat, 
-                          int beg, int size, 
+                          int beg, int size, double latency,
+                          ReadAttempt::Outcome outcome = 
+                          ReadAttempt::ReadError,
                           bool dontWrite = false);
 
   /// Clears the bad sectors in the bad sectors file
   void clearBadSectors(const DVDFileData * dat, 
-                       int beg, int size, 
+                       int beg, int size, double latency,
                        bool dontWrite = false);
 
+  /// Returns a ReadAttempt for the current pass and the given source
+  /// (the main one if NULL).
+  ReadAttempt currentAttempt(ReadAttempt::Outcome outcome, double latency,
+                             const DVDSource * src = NULL);
+
+  /// Protects the bad sectors, the progress and the output files when
+  /// several drives work together, or when several files are copied
+  /// at the same time.
+  std::mutex stateMutex;
+
+  /// The number of files copied at the same time, depending on the
+  /// source and on jobs.
+  int copyJobs() const;
+
+  /// Reads the sectors of the @a queue that are given to the drive
+  /// number @a drive, reading from @a src, and writes the sectors
+  /// read to the corresponding @a outputs (indexed like files).
+  void recoverSectors(int drive, DVDSource * src, 
+                      SharedRetryQueue & queue,
+                      std::map<int, std::unique_ptr<DVDOutFile> > & outputs);
+
+  /// The name of the current pass, used in the history of the bad
+  /// sectors.
+  std::string passName;
+
 
   /// sets up the reader and gets the list of files, and sets up the
   /// target, creating the target directories if necessary.
+  ///
+  /// If the reader is already set up for the same source, it is kept
+  /// as is, along with the opened files.
+  ///
+  /// The additional sources are not opened here, see
+  /// setupOtherSources().
   void setup(const char * source, const char * target);
 
-  /// The underlying files of the source
+  /// The underlying files of the source (they belong to source)
   std::vector<DVDFileData *> files;
 
+  /// Opens the additional sources, and checks that they hold the
+  /// same disc as the main one.
+  void setupOtherSources();
+
   /// reads the bad sectors from the bad sectors file
   void readBadSectors();
 
@@ -131,6 +293,25 @@ class DVDCopy {
   /// target if empty.
   std::string badSectorsFileName;
 
+  /// The map of the latency and errors of the reads of the main
+  /// source, when recordSurface is on.
+  std::unique_ptr<SurfaceMap> surface;
+
+  /// The name of the file of the surface map: that of the bad
+  /// sectors file with a @a .map suffix.
+  std::string surfaceMapFileName() const;
+
+  /// Loads the surface map, if recordSurface is on.
+  void loadSurfaceMap();
+
+  /// Writes the surface map back, and stops recording.
+  void saveSurfaceMap();
+
+  /// Records in the surface map the read of @a nb sectors of @a dat
+  /// at @a offset from the main source.
+  void recordReads(const DVDFileData * dat, int offset, int nb,
+                   double latency, bool success);
+
 
   /// Finds the index of the file referred to by the title, domain,
   /// number triplet. Returns -1 if not found.
@@ -152,8 +333,23 @@ class DVDCopy {
 
   Progress overallProgress;
 
+  /// The name of the given source (the main one if NULL) in the
+  /// metrics (see Metrics and metricsName).
+  std::string metricsDevice(const DVDSource * src = NULL) const;
+
 public:
 
+  /// The progress of the last operation
+  const Progress & progress() const {
+    return overallProgress;
+  };
+
+  /// Calls @a callback each time the progress is shown (see
+  /// Progress::onUpdate).
+  void watchProgress(std::function<void (const Progress &)> callback) {
+    overallProgress.onUpdate = callback;
+  };
+
   DVDCopy();
 
   /// Sets the bad sectors file name
@@ -173,9 +369,19 @@ public:
   /// Does a second pass, reading a bad sector files
   void secondPass(const char * source, const char * dest);
 
-  /// Scans the source for bad sectors and make a bad sector list
-  void scanForBadSectors(const char * source, 
-                         const char * badSectorsFileName);
+  /// Scans the source for bad sectors and make a bad sector list.
+  /// Returns the number of bad sectors.
+  int scanForBadSectors(const char * source, 
+                        const char * badSectorsFileName);
+
+  /// Compares the copy in @a dest with the source, sector by
+  /// sector. The sectors listed as bad for the copy are not
+  /// compared. Returns the number of sectors that differ.
+  int verify(const char * source, const char * dest);
+
+  /// Takes over the options of @a other (but not its source nor its
+  /// target), to run another operation in the same way.
+  void copyOptions(const DVDCopy & other);
 
 
   /// Scans the source's IFO files for information.
@@ -191,6 +397,81 @@ public:
   /// If this is true, then the second pass is done backwards
   bool backwards;
 
+  /// The maximum number of failed attempts on a sector, after which
+  /// the second pass stops trying to read it. Negative means no
+  /// limit.
+  int maxAttempts;
+
+  /// The interleave of the ECC blocks during the second pass (see
+  /// RetryScheduler).
+  int interleave;
+
+  /// The number of times a sector that failed is retried right away
+  /// during the second pass.
+  int retries;
+
+  /// How these retries are done.
+  RetryStrategy retryStrategy;
+
+  /// If true, the sectors are read directly into a memory mapping of
+  /// the output files (see DVDOutFile::useMap).
+  bool mapOutput;
+
+  /// If true (the default), the files of directories and unencrypted
+  /// images are read directly (see DVDSource::directAccess).
+  bool directAccess;
+
+  /// The number of files copied at the same time when the source is
+  /// an image or a directory (see DVDSource::isSeekFree()), or 0 for
+  /// as many as processors. Files on physical discs are always copied
+  /// one at a time.
+  int jobs;
+
+  /// The number of chunks read ahead when reading files directly (see
+  /// DVDSource::queueDepth), 0 to read synchronously.
+  int queueDepth;
+
+  /// The name of the main source in the metrics (see Metrics), if
+  /// not its device (for instance for images, whose path changes
+  /// with each disc).
+  std::string metricsName;
+
+  /// If true, the latency and outcome of the reads of the main source
+  /// are recorded in a map of the surface of the disc (see
+  /// SurfaceMap), next to the bad sectors file.
+  bool recordSurface;
+
+  /// Simulates the errors of a damaged disc in a drive with a cache
+  /// on top of the real sources, for testing reading strategies (see
+  /// SimulatedDrive for the format of @a spec).
+  void simulateDrive(const char * spec);
+
+  /// Records all the reads of the main source in the session log @a
+  /// file (see SessionRecorder).
+  void recordSession(const char * file);
+
+  /// Replays the reads recorded in the session log @a file on top of
+  /// the main source (see ReplayedDrive), to try reading strategies
+  /// offline against the damage of a real disc.
+  void replaySession(const char * file);
+
+  /// If positive, the replayed reads take their recorded time
+  /// divided by this (see ReplayedDrive::speed).
+  double replaySpeed;
+
+  /// The copy and the second pass always check that the sectors of
+  /// the VOB files they read are valid MPEG packs, as the scan does,
+  /// and skip the invalid ones like the sectors that could not be
+  /// read. If true, the VOB files are always read, so that all their
+  /// sectors are checked, even when they could be copied without
+  /// reading them (see DVDFile::copySectorsTo()).
+  bool validatePacks;
+
+  /// Adds a source holding another copy of the same disc (or the same
+  /// disc in another drive). All the sources work together during the
+  /// second pass, each trying the sectors the others failed to read.
+  void addSource(const char * device);
+
 
   ~DVDCopy();
 };
@@ -29,6 +29,8 @@
 
 #ifdef HAVE_LINUX_CDROM_H
 #include <linux/cdrom.h>
+// CDSL_CURRENT is defined as INT_MAX
+#include <limits.h>
 #endif
 
 void DVDDrive::eject(const char * drive)
@@ -55,3 +57,22 @@ void DVDDrive::eject(const char * drive)
   close(fd);
 #endif
 }
+
+DVDDrive::DiscStatus DVDDrive::discStatus(const char * drive)
+{
+#ifndef HAVE_LINUX_CDROM_H
+  return UnknownStatus;
+#else
+  int fd = open(drive, O_RDONLY|O_NONBLOCK);
+  if(fd < 0)
+    return NoDisc;
+  int status = ioctl(fd, CDROM_DRIVE_STATUS, CDSL_CURRENT);
+  int error = errno;
+  close(fd);
+  if(status < 0)
+    return error == ENOSYS ? UnknownStatus : NoDisc;
+  if(status == CDS_NO_INFO)
+    return UnknownStatus;
+  return status == CDS_DISC_OK ? DiscPresent : NoDisc;
+#endif
+}
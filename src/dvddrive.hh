@@ -26,6 +26,19 @@ public:
 
   /// Ejects the target drive
   static void eject(const char * drive);
+
+  /// What a drive tells about its disc
+  enum DiscStatus {
+    /// There is a readable disc in the drive
+    DiscPresent,
+    /// There is no disc, or the tray is open
+    NoDisc,
+    /// The drive (or the platform) cannot tell
+    UnknownStatus
+  };
+
+  /// Whether there is a readable disc in the drive.
+  static DiscStatus discStatus(const char * drive);
 };
 
 
@@ -20,6 +20,12 @@
 #include "headers.hh"
 #include "dvdfile.hh"
 #include "dvdreader.hh"
+#include "retryscheduler.hh"
+#include "dvdoutfile.hh"
+#include "uringqueue.hh"
+#include "stats.hh"
+#include "trace.hh"
+#include "flightrecorder.hh"
 
 /* For stat(2), open(2) and comrades... */
 #include <sys/types.h>
@@ -32,6 +38,7 @@
 #include <stdio.h>
 
 #include <sys/time.h>
+#include <algorithm>
 
 
 #define SECTOR_SIZE 2048
@@ -43,6 +50,9 @@ class DVDByteFile : public DVDFile {
   int blockOffset;
 public:
   virtual int readBlocks(int offset, int blocks, unsigned char * dest) {
+    std::unique_lock<std::mutex> lock;
+    if(readerMutex)
+      lock = std::unique_lock<std::mutex>(*readerMutex);
     if(offset != blockOffset) {
       /// @todo error handling here.
       DVDFileSeek(file, offset * SECTOR_SIZE);
@@ -50,7 +60,13 @@ public:
 
     /// @todo By construction, this function doesn't work with
     /// sub-sector granularity.
-    int nbread = DVDReadBytes(file, dest, blocks * SECTOR_SIZE);
+    int nbread;
+    {
+      STATS_TIMER(ReadBytes);
+      Trace::Span span("DVDReadBytes", "read");
+      span.set("sector", offset).set("sectors", blocks);
+      nbread = DVDReadBytes(file, dest, blocks * SECTOR_SIZE);
+    }
     if(nbread < 0)
       return -1;
     nbread /= SECTOR_SIZE;
@@ -70,6 +86,12 @@ public:
 class DVDBlockFile : public DVDFile {
 public:
   virtual int readBlocks(int offset, int blocks, unsigned char * dest) {
+    std::unique_lock<std::mutex> lock;
+    if(readerMutex)
+      lock = std::unique_lock<std::mutex>(*readerMutex);
+    STATS_TIMER(ReadBlocks);
+    Trace::Span span("DVDReadBlocks", "read");
+    span.set("sector", offset).set("sectors", blocks);
     return DVDReadBlocks(file, offset, blocks, dest);
   }
 
@@ -85,14 +107,17 @@ public:
 //////////////////////////////////////////////////////////////////////
 
 DVDFile::DVDFile(dvd_file_t * f, const DVDFileData * d) :
-  file(f), dat(d)
+  file(f), dat(d), lastReadTime(0),
+  retries(0), retryStrategy(NULL), readerMutex(NULL),
+  position(0), positionSize(0)
 {
   // file shouldn't be 0 !
 }
 
 DVDFile::~DVDFile()
 {
-  DVDCloseFile(file);
+  if(file)
+    DVDCloseFile(file);
 }
 
 
@@ -101,9 +126,28 @@ int DVDFile::fileSize()
   return DVDFileSize(file);
 }
 
+int DVDFile::copySectorsTo(DVDOutFile & out, int start, int nb)
+{
+  return 0;
+}
+
+void DVDFile::willRead(int start, int nb, int steps)
+{
+}
+
 DVDFile * DVDFile::openFile(dvd_reader_t * reader, const DVDFileData * dat)
 {
-  dvd_file_t * file = DVDOpenFile(reader, dat->title, dat->domain);
+  dvd_file_t * file;
+  {
+    STATS_TIMER(OpenFile);
+    // The CSS key of the VOBs is fetched when they are opened
+    bool vob = (dat->domain == DVD_READ_MENU_VOBS || 
+                dat->domain == DVD_READ_TITLE_VOBS);
+    Trace::Span span("DVDOpenFile", vob ? "open,css" : "open");
+    if(Trace::enabled())
+      span.set("file", dat->fileName(true));
+    file = DVDOpenFile(reader, dat->title, dat->domain);
+  }
   if(! file)
     return NULL;
 
@@ -122,60 +166,241 @@ DVDFile * DVDFile::openFile(dvd_reader_t * reader, const DVDFileData * dat)
 }
 
 
-void DVDFile::walkFile(int start, int blocks, int steps, 
-                       const std::function<void (int offset, int nb, 
-                                                 unsigned char * buffer,
-                                                 const DVDFileData * dat)> & 
-                         successfulRead,
-                       const std::function<void (int offset, int nb, 
-                                                 const DVDFileData * dat)> & 
-                         failedRead)
-{
-  if(steps < 0)
-    steps = 128;                // Decent default ?
-  std::unique_ptr<unsigned char[]> 
-    readBuffer(new unsigned char[steps * SECTOR_SIZE]); 
-
-  int overallSize = fileSize();
-  int remaining = overallSize - start;
-  int blk = start;
-  int nb;
-  int read;
-  if(blocks < remaining)
-    remaining = blocks;
-
-  printf("\nReading %d sectors at a time\n", steps); 
-  while(remaining > 0) {
-    /* First, we determine the number of blocks to be read */
-    if(remaining > steps)
-      nb = steps;
-    else
-      nb = remaining;
-	  
-    std::string fileName = dat->fileName(true, blk);
-    printf("\r%s: %7d/%d",
-           fileName.c_str(),
-           blk, overallSize);
-    read = readBlocks(blk, nb, (unsigned char*) readBuffer.get());
-
-    if(read < nb) {
-      if(read > 0)
-        successfulRead(blk, read, readBuffer.get(), dat);
-      if(read < 0)
-        read = 0;
-      blk += read;
-      int failed = nb - read;
-      /* There was an error reading the file. */
-      printf("\nError while reading block %d of file %s\n",
-             blk, fileName.c_str());
-      failedRead(blk, failed, dat);
-      read = nb;
+int DVDFile::readChunk(int blk, int nb, unsigned char * buffer,
+                       int overallSize)
+{
+  positionSize = overallSize;
+  position = blk;
+  FlightRecorder::record(FlightRecorder::Request, dat, blk, nb);
+  struct timeval before, after;
+  gettimeofday(&before, NULL);
+  int read = readBlocks(blk, nb, buffer);
+
+  // Single-sector reads may be retried, possibly after reading
+  // somewhere else so that the drive really tries again.
+  SectorBuffer bustBuffer;
+  for(int i = 0; nb == 1 && read < 1 && i < retries; i++) {
+    bool bust = retryStrategy && retryStrategy->shouldBust();
+    if(bust) {
+      int far = retryStrategy->farSector(blk, overallSize);
+      if(! bustBuffer.data())
+        bustBuffer = SectorArena::global().allocate(retryStrategy->size);
+      readBlocks(far, retryStrategy->size, bustBuffer.data());
     }
-    else 
-      successfulRead(blk, read, readBuffer.get(), dat);
+    read = readBlocks(blk, nb, buffer);
+    if(retryStrategy)
+      retryStrategy->recordOutcome(bust, read == 1);
+  }
+  gettimeofday(&after, NULL);
+  lastReadTime = (after.tv_sec - before.tv_sec)*1.0 + 
+    1e-6 * (after.tv_usec - before.tv_usec);
+  return read;
+}
+
+void DVDFile::reportError(int blk) const
+{
+  std::string fileName = dat->fileName(true, blk);
+  /* There was an error reading the file. */
+  printf("\nError while reading block %d of file %s\n",
+         blk, fileName.c_str());
+}
 
-    remaining -= read;
-    blk += read;
+//////////////////////////////////////////////////////////////////////
+
+DVDPlainFile::DVDPlainFile(const std::vector<Extent> & e, 
+                           const DVDFileData * d) :
+  DVDFile(NULL, d), extents(e), queueDepth(0),
+  nextRead(0), readEnd(0), readSteps(0)
+{
+  for(const Extent & ext : extents)
+    posix_fadvise(ext.fd, ext.start * SECTOR_SIZE, 
+                  (off_t) ext.sectors * SECTOR_SIZE,
+                  POSIX_FADV_SEQUENTIAL);
+}
+
+DVDPlainFile::~DVDPlainFile()
+{
+  // The kernel may still be writing to the buffers
+  drain();
+  for(const Extent & ext : extents)
+    close(ext.fd);
+}
+
+int DVDPlainFile::fileSize()
+{
+  int size = 0;
+  for(const Extent & ext : extents)
+    size += ext.sectors;
+  return size;
+}
+
+const DVDPlainFile::Extent * DVDPlainFile::findExtent(int sector,
+                                                      int * offset) const
+{
+  for(const Extent & ext : extents) {
+    if(sector < ext.sectors) {
+      *offset = sector;
+      return &ext;
+    }
+    sector -= ext.sectors;
+  }
+  return NULL;
+}
 
+int DVDPlainFile::readDirectly(int offset, int blocks, unsigned char * dest)
+{
+  int done = 0;
+  while(done < blocks) {
+    int pos;
+    const Extent * ext = findExtent(offset + done, &pos);
+    if(! ext)
+      break;
+    int nb = std::min(blocks - done, ext->sectors - pos);
+    ssize_t rd = pread(ext->fd, dest + (size_t) done * SECTOR_SIZE,
+                       (size_t) nb * SECTOR_SIZE, 
+                       (ext->start + pos) * SECTOR_SIZE);
+    if(rd < 0)
+      return done > 0 ? done : -1;
+    done += rd / SECTOR_SIZE;
+    if(rd < (ssize_t) nb * SECTOR_SIZE)
+      break;
+  }
+  return done;
+}
+
+int DVDPlainFile::copySectorsTo(DVDOutFile & out, int start, int nb)
+{
+  struct timeval before, after;
+  gettimeofday(&before, NULL);
+  int done = 0;
+  while(done < nb) {
+    int pos;
+    const Extent * ext = findExtent(start + done, &pos);
+    if(! ext)
+      break;
+    int n = std::min(nb - done, ext->sectors - pos);
+    int copied = out.copyFrom(ext->fd, ext->start + pos, n);
+    done += copied;
+    if(copied < n)
+      break;
+  }
+  gettimeofday(&after, NULL);
+  lastReadTime = (after.tv_sec - before.tv_sec)*1.0 + 
+    1e-6 * (after.tv_usec - before.tv_usec);
+  return done;
+}
+
+bool DVDPlainFile::setQueueDepth(int depth)
+{
+  drain();
+  queue.reset();
+  queueDepth = 0;
+  if(depth <= 0)
+    return true;
+  try {
+    // Chunks may span two extents, ie need two requests
+    queue.reset(new UringQueue(2 * depth));
+  }
+  catch(const std::runtime_error & e) {
+    return false;
+  }
+  queueDepth = depth;
+  return true;
+}
+
+void DVDPlainFile::readAhead()
+{
+  while((int) pending.size() < queueDepth && nextRead < readEnd) {
+    int nb = std::min(readSteps, readEnd - nextRead);
+    pending.push_back(Pending());
+    Pending & chunk = pending.back();
+    chunk.offset = nextRead;
+    chunk.blocks = nb;
+    chunk.buffer = SectorArena::global().allocate(nb);
+    chunk.outstanding = 0;
+    chunk.bytes = 0;
+    chunk.failed = false;
+    int done = 0;
+    while(done < nb) {
+      int pos;
+      const Extent * ext = findExtent(chunk.offset + done, &pos);
+      if(! ext) {
+        chunk.failed = true;
+        break;
+      }
+      int n = std::min(nb - done, ext->sectors - pos);
+      queue->queueRead(ext->fd, chunk.buffer.sector(done), 
+                       (size_t) n * SECTOR_SIZE,
+                       (off_t) (ext->start + pos) * SECTOR_SIZE,
+                       reinterpret_cast<unsigned long>(&chunk));
+      chunk.outstanding++;
+      done += n;
+    }
+    nextRead += nb;
+  }
+  queue->submit();
+}
+
+void DVDPlainFile::waitFor(Pending & chunk)
+{
+  while(chunk.outstanding > 0) {
+    unsigned long tag;
+    int result;
+    queue->waitCompletion(&tag, &result);
+    Pending * done = reinterpret_cast<Pending *>(tag);
+    done->outstanding--;
+    if(result < 0)
+      done->failed = true;
+    else
+      done->bytes += result;
+  }
+}
+
+void DVDPlainFile::drain()
+{
+  for(Pending & chunk : pending)
+    waitFor(chunk);
+  pending.clear();
+  nextRead = readEnd = 0;
+}
+
+void DVDPlainFile::willRead(int start, int nb, int steps)
+{
+  if(! queue)
+    return;
+  drain();
+  nextRead = start;
+  readEnd = std::min(start + nb, fileSize());
+  readSteps = steps;
+  readAhead();
+}
+
+int DVDPlainFile::readBlocks(int offset, int blocks, unsigned char * dest)
+{
+  STATS_TIMER(DirectRead);
+  Trace::Span span("direct read", "read");
+  span.set("sector", offset).set("sectors", blocks);
+  // Chunks that were skipped over are useless (but not when reading
+  // elsewhere for a while, as retryStrategy does)
+  while(! pending.empty() && offset < nextRead &&
+        pending.front().offset + pending.front().blocks <= offset) {
+    waitFor(pending.front());
+    pending.pop_front();
+  }
+  if(! pending.empty() && pending.front().offset == offset &&
+     pending.front().blocks == blocks) {
+    Pending & chunk = pending.front();
+    waitFor(chunk);
+    bool ok = ! chunk.failed && 
+      chunk.bytes == (long) blocks * SECTOR_SIZE;
+    if(ok)
+      memcpy(dest, chunk.buffer.data(), (size_t) blocks * SECTOR_SIZE);
+    pending.pop_front();
+    readAhead();
+    if(ok)
+      return blocks;
+    // Reading again synchronously tells exactly which sectors are
+    // missing.
   }
+  return readDirectly(offset, blocks, dest);
 }
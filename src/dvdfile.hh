@@ -20,7 +20,14 @@
 #ifndef __DVDFILE_H
 #define __DVDFILE_H
 
+#include "badsectors.hh"
+#include "sectorbuffer.hh"
+#include <stdio.h>
+
 class DVDFileData;
+class DVDOutFile;
+class RetryStrategy;
+class UringQueue;
 
 /// Handles reading input files.
 class DVDFile {
@@ -32,8 +39,20 @@ protected:
   /// And a DVDFileData for output purposes
   const DVDFileData * dat;
 
+  /// The time taken by the last read within walkFile(), in seconds
+  double lastReadTime;
+
   DVDFile(dvd_file_t * f, const DVDFileData * d);
 
+  /// Reads the @a nb sectors at @a blk into @a buffer, recording the
+  /// position, and keeping track of the time it took. Single-sector
+  /// reads are retried (see retries). Returns the number of sectors
+  /// read, or -1 on error.
+  int readChunk(int blk, int nb, unsigned char * buffer, int overallSize);
+
+  /// Tells that reading the sector @a blk failed.
+  void reportError(int blk) const;
+
 public:
 
   /// Reads a given number of blocks at the given offset, and returns
@@ -41,7 +60,47 @@ public:
   virtual int readBlocks(int offset, int blocks, unsigned char * dest) = 0;
 
   /// Returns the size of the file in blocks
-  int fileSize();
+  virtual int fileSize();
+
+  /// Copies the @a nb sectors from @a start to the current position
+  /// of @a out without reading them, when the file can be accessed
+  /// directly. Returns the number of sectors copied, which can be
+  /// less than @a nb (and is 0 for files that can only be read).
+  virtual int copySectorsTo(DVDOutFile & out, int start, int nb);
+
+  /// Tells that the @a nb sectors from @a start are going to be read
+  /// in order, by chunks of @a steps sectors, so that they can be
+  /// read ahead. Does nothing by default.
+  virtual void willRead(int start, int nb, int steps);
+
+  /// The number of times a failed single-sector read is retried by
+  /// walkFile() (0 by default).
+  int retries;
+
+  /// If not NULL, decides whether walkFile() should read elsewhere
+  /// before retrying a sector.
+  RetryStrategy * retryStrategy;
+
+  /// If not NULL, this mutex is held while reading through
+  /// libdvdread, since files of the same reader cannot be read from
+  /// several threads at once.
+  std::mutex * readerMutex;
+
+  /// The sector being read by walkFile(), and the size of the file,
+  /// for showing the progress from another thread (see Progress).
+  std::atomic<int> position;
+  std::atomic<int> positionSize;
+
+  /// The underlying file
+  const DVDFileData * fileData() const {
+    return dat;
+  };
+
+  /// Returns the time the last read done by walkFile() took, in
+  /// seconds. This is meant to be used from within the stages.
+  double lastReadDuration() const {
+    return lastReadTime;
+  };
 
 
   /// Opens the given file. This returns something that should be
@@ -57,18 +116,143 @@ public:
   virtual ~DVDFile();
 
   /// This functions reads @a blocks of blocks starting at @a start,
-  /// by reads of @a steps block and runs the given functions upon
-  /// successful reads and failed reads.
-  void walkFile(int start, int blocks, int steps, 
-                const std::function<void (int offset, int nb, 
-                                          unsigned char * buffer,
-                                          const DVDFileData * dat)> & 
-                successfulRead,
-                const std::function<void (int offset, int nb, 
-                                          const DVDFileData * dat)> & 
-                failedRead);
+  /// by reads of @a steps block and passes the sectors read and the
+  /// ones that failed to the given @a stage (see Pipeline).
+  template<class Stage>
+  void walkFile(int start, int blocks, int steps, Stage & stage) {
+    if(steps < 0)
+      steps = 128;                // Decent default ?
+    SectorBuffer readBuffer = SectorArena::global().allocate(steps);
+
+    int overallSize = fileSize();
+    int remaining = overallSize - start;
+    int blk = start;
+    if(blocks < remaining)
+      remaining = blocks;
+    willRead(blk, remaining, steps);
+
+    printf("\nReading %d sectors at a time\n", steps); 
+    while(remaining > 0) {
+      int nb = remaining > steps ? steps : remaining;
+      unsigned char * buffer = stage.readBuffer(blk, nb);
+      if(! buffer)
+        buffer = readBuffer.data();
+      int read = readChunk(blk, nb, buffer, overallSize);
+      if(read < nb) {
+        if(read > 0)
+          stage.sectorsRead(blk, read, buffer, dat);
+        else
+          read = 0;
+        reportError(blk + read);
+        stage.sectorsFailed(blk + read, nb - read, 
+                            ReadAttempt::ReadError, dat);
+      }
+      else 
+        stage.sectorsRead(blk, nb, buffer, dat);
+      remaining -= nb;
+      blk += nb;
+    }
+  };
+
 };
 
 
 
+/// A file that is read directly from the file system rather than
+/// through libdvdread: files in a directory, or the files of an
+/// unencrypted image. It can be copied without going through user
+/// space (see copySectorsTo()).
+class DVDPlainFile : public DVDFile {
+public:
+  /// A consecutive range of sectors of the file, found in a file
+  /// descriptor.
+  class Extent {
+  public:
+    /// The file descriptor, which belongs to the DVDPlainFile
+    int fd;
+    /// The position of the first sector in fd, in sectors
+    long start;
+    /// The number of sectors
+    int sectors;
+
+    Extent(int f, long st, int s) : fd(f), start(st), sectors(s) {;};
+  };
+
+protected:
+  /// The extents, one after the other
+  std::vector<Extent> extents;
+
+  /// Finds the extent containing the given sector, and sets @a
+  /// offset to the position of the sector within the extent. Returns
+  /// NULL if there is no such extent.
+  const Extent * findExtent(int sector, int * offset) const;
+
+  /// Reads the sectors synchronously
+  int readDirectly(int offset, int blocks, unsigned char * dest);
+
+  /// A chunk being read ahead
+  class Pending {
+  public:
+    /// The position and size of the chunk
+    int offset;
+    int blocks;
+    /// Where it is read
+    SectorBuffer buffer;
+    /// The number of requests still in flight
+    int outstanding;
+    /// The number of bytes read so far
+    long bytes;
+    /// Whether one of the requests failed
+    bool failed;
+  };
+
+  /// The queue used for reading ahead, or NULL
+  std::unique_ptr<UringQueue> queue;
+
+  /// The maximum number of chunks read ahead
+  int queueDepth;
+
+  /// The chunks in flight, in the order in which they will be
+  /// read. This is a list so that their addresses, used as tags for
+  /// the requests, do not change.
+  std::list<Pending> pending;
+
+  /// The next chunk to read ahead, the end of the sectors to read,
+  /// and the size of the chunks
+  int nextRead;
+  int readEnd;
+  int readSteps;
+
+  /// Queues chunks until there are queueDepth of them in flight.
+  void readAhead();
+
+  /// Waits for all the requests of the given chunk to complete.
+  void waitFor(Pending & chunk);
+
+  /// Waits for all the chunks in flight and forgets about them.
+  void drain();
+
+public:
+
+  /// Creates a file made of the given extents, which it owns.
+  DVDPlainFile(const std::vector<Extent> & extents, 
+               const DVDFileData * dat);
+
+  /// Keeps up to @a depth chunks read ahead in flight through
+  /// io_uring when reading with walkFile(), or reads synchronously if
+  /// @a depth is 0. Returns false if io_uring is not available, in
+  /// which case the reads stay synchronous.
+  bool setQueueDepth(int depth);
+
+  virtual int readBlocks(int offset, int blocks, unsigned char * dest);
+
+  virtual void willRead(int start, int nb, int steps);
+
+  virtual int fileSize();
+
+  virtual int copySectorsTo(DVDOutFile & out, int start, int nb);
+
+  virtual ~DVDPlainFile();
+};
+
 #endif
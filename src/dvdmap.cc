@@ -0,0 +1,268 @@
+/**
+    \file dvdmap.cc
+    dvdmap, turns the surface maps of dvdcopy into CSV files or images
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "headers.hh"
+#include "surfacemap.hh"
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+
+/// The radius of the start of the data zone, in mm
+static const double innerRadius = 24;
+
+/// The radius of the end of the data zone of a full single-layer
+/// disc, in mm
+static const double outerRadius = 58;
+
+/// The number of sectors of a full single-layer disc
+static const double discSectors = 2295104;
+
+/// The track pitch, in mm
+static const double trackPitch = 0.74e-3;
+
+/// Where the sectors are on the disc, as the discs are written at
+/// constant linear velocity. The second layer of dual-layer discs
+/// (opposite track path) goes back from the outside to the inside,
+/// starting at @a layerBreak.
+class DiscGeometry {
+public:
+  long layerBreak;
+
+  DiscGeometry() : layerBreak(-1) {;};
+
+  int layer(long sector) const {
+    return (layerBreak > 0 && sector >= layerBreak) ? 1 : 0;
+  };
+
+  /// The position of the sector within its layer, counted from the
+  /// inside
+  double layerPosition(long sector) const {
+    if(layer(sector) == 0)
+      return sector;
+    return 2.0 * layerBreak - 1 - sector;
+  };
+
+  /// The radius of the sector, in mm
+  double radius(long sector) const {
+    double s = layerPosition(sector);
+    return sqrt(innerRadius * innerRadius + 
+                s * (outerRadius * outerRadius - innerRadius * innerRadius)
+                / discSectors);
+  };
+
+  /// The sector of the given layer at the given radius (in mm)
+  long sector(int layer, double r) const {
+    long s = (r * r - innerRadius * innerRadius) * discSectors / 
+      (outerRadius * outerRadius - innerRadius * innerRadius);
+    if(layer == 1)
+      s = 2 * layerBreak - 1 - s;
+    return s;
+  };
+};
+
+/// Writes one line per block that was read
+static void writeCSV(const std::vector<SurfaceMap::Block> & blocks,
+                     const DiscGeometry & geometry)
+{
+  printf("block,sector,layer,radius_mm,reads,failures,"
+         "mean_latency_ms,max_latency_ms\n");
+  for(long i = 0; i < (long) blocks.size(); i++) {
+    const SurfaceMap::Block & b = blocks[i];
+    if(b.reads == 0)
+      continue;
+    long sector = i * SurfaceMap::BLOCK_SECTORS;
+    printf("%ld,%ld,%d,%.3f,%d,%d,%.3f,%.3f\n", i, sector,
+           geometry.layer(sector), geometry.radius(sector),
+           b.reads, b.failures, 1e-3 * b.totalLatency / b.reads,
+           1e-3 * b.maxLatency);
+  }
+}
+
+/// Writes a PPM image of the disc, with one disc per layer, of @a size
+/// pixels. Each pixel shows the blocks of all the turns of the track
+/// it covers, at its angle: gray if they were not read, red if some
+/// reads failed, and from green to yellow as the reads get slower
+/// (up to ten times the median latency).
+static void writeImage(const std::vector<SurfaceMap::Block> & blocks,
+                       const DiscGeometry & geometry,
+                       const char * file, int size)
+{
+  // The median latency, for the colour scale
+  std::vector<double> latencies;
+  for(const SurfaceMap::Block & b : blocks)
+    if(b.reads > 0 && b.failures == 0)
+      latencies.push_back(double(b.totalLatency) / b.reads);
+  double median = 1;
+  if(latencies.size() > 0) {
+    std::nth_element(latencies.begin(), 
+                     latencies.begin() + latencies.size()/2, 
+                     latencies.end());
+    median = std::max(1.0, latencies[latencies.size()/2]);
+  }
+
+  int layers = geometry.layerBreak > 0 ? 2 : 1;
+  std::vector<unsigned char> pixels(3 * size * size * layers, 0);
+  double scale = 2 * (outerRadius + 2) / size; // mm per pixel
+
+  for(int l = 0; l < layers; l++) {
+    for(int y = 0; y < size; y++) {
+      for(int x = 0; x < size; x++) {
+        unsigned char * px = &pixels[3 * (y * size * layers + 
+                                          l * size + x)];
+        double dx = (x + 0.5 - size/2.0) * scale;
+        double dy = (size/2.0 - y - 0.5) * scale;
+        double r = sqrt(dx*dx + dy*dy);
+        if(r > outerRadius + 1)
+          continue;
+        if(r < innerRadius) {
+          px[0] = px[1] = px[2] = 64;
+          continue;
+        }
+        double turn = atan2(dy, dx) / (2 * M_PI);
+        if(turn < 0)
+          turn += 1;
+
+        // All the turns of the track under the pixel
+        long reads = 0, failures = 0;
+        double latency = 0;
+        long first = ceil((r - scale/2 - innerRadius)/trackPitch - turn);
+        long last = floor((r + scale/2 - innerRadius)/trackPitch - turn);
+        long lastBlock = -1;
+        for(long n = std::max(first, 0L); n <= last; n++) {
+          double rn = innerRadius + (n + turn) * trackPitch;
+          long blk = geometry.sector(l, rn) / SurfaceMap::BLOCK_SECTORS;
+          if(blk < 0 || blk >= (long) blocks.size() || blk == lastBlock)
+            continue;
+          lastBlock = blk;
+          const SurfaceMap::Block & b = blocks[blk];
+          if(geometry.layer(blk * SurfaceMap::BLOCK_SECTORS) != l)
+            continue;
+          reads += b.reads;
+          failures += b.failures;
+          latency += b.totalLatency;
+        }
+        if(reads == 0) {
+          px[0] = px[1] = px[2] = 160;
+        }
+        else if(failures > 0) {
+          px[0] = 255; px[1] = 0; px[2] = 0;
+        }
+        else {
+          double slow = log10(latency / reads / median);
+          slow = std::min(1.0, std::max(0.0, slow));
+          px[0] = 255 * slow; px[1] = 200; px[2] = 0;
+        }
+      }
+    }
+  }
+
+  FILE * out = fopen(file, "wb");
+  if(! out) {
+    std::string err = std::string("Could not write '") + file + "': " + 
+      strerror(errno);
+    throw std::runtime_error(err);
+  }
+  fprintf(out, "P6\n%d %d\n255\n", size * layers, size);
+  fwrite(pixels.data(), 1, pixels.size(), out);
+  fclose(out);
+}
+
+void printHelp(const char * progname)
+{
+  std::cout << "Usage: " << progname << " [options] map\n\n"
+            << "Writes the surface map recorded by dvdcopy --surface-map\n"
+            << "as CSV to the standard output, or as an image\n\n"
+            << "Options: \n"
+            << " -h, --help: print this help message\n"
+            << " -i, --image FILE: write a PPM image of the disc to FILE\n"
+            << "     instead, with a disc for each layer\n"
+            << " -s, --size NB: the size of the discs in the image, in pixels\n"
+            << " -L, --layer-break SECTOR: the first sector of the second\n"
+            << "     layer, for dual-layer discs\n";
+}
+
+static struct option long_options[] = {
+  { "help", 0, NULL, 'h'},
+  { "image", 1, NULL, 'i'},
+  { "size", 1, NULL, 's'},
+  { "layer-break", 1, NULL, 'L'},
+  { NULL, 0, NULL, 0}
+};
+
+int main(int argc, char ** argv)
+{
+  DiscGeometry geometry;
+  const char * image = NULL;
+  int size = 512;
+  int option;
+
+  do {
+    option = getopt_long(argc, argv, "hi:s:L:", long_options, NULL);
+    switch(option) {
+    case -1: break;
+    case 'i':
+      image = optarg;
+      break;
+    case 's':
+      size = atoi(optarg);
+      break;
+    case 'L':
+      geometry.layerBreak = atol(optarg);
+      break;
+    case 'h':
+      printHelp(argv[0]);
+      return 0;
+    default:
+      printHelp(argv[0]);
+      return 1;
+    }
+  } while(option != -1);
+
+  if(argc != optind + 1 || size <= 0) {
+    printHelp(argv[0]);
+    return 1;
+  }
+
+  try {
+    SurfaceMap map;
+    map.load(argv[optind]);
+    const std::vector<SurfaceMap::Block> & blocks = map.data();
+    if(blocks.empty()) {
+      fprintf(stderr, "Nothing recorded in '%s'\n", argv[optind]);
+      return 1;
+    }
+    if(geometry.layerBreak <= 0 && 
+       blocks.size() * SurfaceMap::BLOCK_SECTORS > discSectors)
+      fprintf(stderr, "The map is larger than a single layer, "
+              "use --layer-break to split it\n");
+    if(image)
+      writeImage(blocks, geometry, image, size);
+    else
+      writeCSV(blocks, geometry);
+  }
+  catch(const std::exception & e) {
+    fprintf(stderr, "Error: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -20,20 +20,77 @@
 #include "headers.hh"
 #include "dvdoutfile.hh"
 #include "dvdreader.hh"
+#include "ratelimiter.hh"
+#include "metrics.hh"
+#include "stats.hh"
+#include "trace.hh"
 
 /* For stat(2), open(2) and comrades... */
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#ifdef HAVE_SYS_XATTR_H
+#include <sys/xattr.h>
+#endif
+#include <sys/syscall.h>
+
+#ifdef HAVE_LINUX_IOPRIO_H
+#include <linux/ioprio.h>
+#endif
 
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <algorithm>
+
+/** The size of the window of the output file mapped in memory, in
+    sectors (see DVDOutFile::mappedSectors()) */
+#define MAP_WINDOW (16*1024)
+
+/** The number of sectors written between two checkpoints of the
+    output files that carry a marker (see DVDOutFile::finalSize) */
+#define CHECKPOINT_INTERVAL 4096
+
+RateLimiter * DVDOutFile::rateLimiter = NULL;
+
+/** The extended attribute holding the number of sectors written to
+    the output files extended beforehand (see DVDOutFile::finalSize) */
+#define WRITTEN_ATTR "user.dvdcopy.written"
+
+/// Returns the number of sectors in the marker of the file opened as
+/// @a fd, or of the file @a name if @a fd is negative, or -1 if it
+/// has none.
+static int readMarker(int fd, const char * name = NULL)
+{
+#ifdef HAVE_SYS_XATTR_H
+  char buffer[32];
+  ssize_t nb = (fd >= 0 ? 
+                fgetxattr(fd, WRITTEN_ATTR, buffer, sizeof(buffer) - 1) :
+                getxattr(name, WRITTEN_ATTR, buffer, sizeof(buffer) - 1));
+  if(nb > 0) {
+    buffer[nb] = 0;
+    return atoi(buffer);
+  }
+#endif
+  return -1;
+}
 
-/** The maximum size of a file, in sectors */
-#define MAX_FILE_SIZE (512*1024)
-#define SECTOR_SIZE 2048
+/// Sets the marker of the file to @a written sectors, or removes it
+/// if @a written is negative. Returns false if that failed, for
+/// instance because the file system does not support it.
+static bool writeMarker(int fd, int written)
+{
+#ifdef HAVE_SYS_XATTR_H
+  if(written < 0)
+    return fremovexattr(fd, WRITTEN_ATTR) == 0 || errno == ENODATA;
+  std::string value = std::to_string(written);
+  return fsetxattr(fd, WRITTEN_ATTR, value.c_str(), value.size(), 0) == 0;
+#else
+  return written < 0;
+#endif
+}
 
 
 std::string DVDOutFile::makeFileName(int number) const
@@ -53,39 +110,190 @@ std::string DVDOutFile::outputFileName(int number) const
 
 DVDOutFile::DVDOutFile(const char * output_dir, int t, 
                        dvd_read_domain_t d) :
-  outputDirectory(output_dir), title(t), domain(d), sector(0), fd(-1)
+  fd(-1), outputDirectory(output_dir), title(t), domain(d), sector(0), 
+  openedNumber(-1), map(NULL), mapStart(0), mapSize(0), 
+  mappedFileSize(0), marked(false), written(0), checkpointed(0),
+  useMap(false), 
+  finalSize(0)
 {
   
 }
 
 void DVDOutFile::openFile()
 {
+  STATS_TIMER(OpenOutput);
+  Trace::Span span("open output", "open,write");
   off_t pos;
   std::string name = outputFileName();
 
   /* Closing to avoid unclosed files */
+  unmap();
   if(fd >= 0)
     close(fd);
-  fd = open(name.c_str(), O_CREAT|O_WRONLY, 0666);
+  // Writable mappings need a file opened for reading too
+  fd = open(name.c_str(), O_CREAT|(useMap ? O_RDWR : O_WRONLY), 0666);
   if(fd <= 0) {
     std::string err("Failed to open output file '");
     err += name + "': " + strerror(errno);
     throw std::runtime_error(err);
   }
+  openedNumber = sector / MAX_FILE_SIZE;
   /* Now, we seek to the position specified by sector */
   pos = SECTOR_SIZE * (sector % MAX_FILE_SIZE);
   lseek(fd, pos, SEEK_SET);
+
+  struct stat fs;
+  fstat(fd, &fs);
+  int size = fs.st_size / SECTOR_SIZE;
+  written = readMarker(fd);
+  marked = written >= 0;
+  if(! marked)
+    written = size;
+  checkpointed = written;
+  if(useMap) {
+    // The file is extended to its final size, so that the sectors
+    // can be read directly into it; the marker tells how much of it
+    // was written, in case the copy stops before the end.
+    int full = std::min(finalSize - openedNumber * MAX_FILE_SIZE, 
+                        MAX_FILE_SIZE);
+    if(full > size && writeMarker(fd, written)) {
+      if(ftruncate(fd, (off_t) full * SECTOR_SIZE) == 0) {
+        marked = true;
+        size = full;
+      }
+      else if(! marked)
+        writeMarker(fd, -1);
+    }
+    mappedFileSize = size;
+  }
+}
+
+void DVDOutFile::unmap()
+{
+  checkpoint();
+  if(! map)
+    return;
+  munmap(map, (size_t) mapSize * SECTOR_SIZE);
+  map = NULL;
 }
 
+void DVDOutFile::checkpoint()
+{
+  // The data must be on the disk, as they would be after a write(),
+  // before the bad sectors file and the marker say so.
+  if(map)
+    msync(map, (size_t) mapSize * SECTOR_SIZE, MS_SYNC);
+  if(marked && fd >= 0) {
+    checkpointed = written;
+    struct stat fs;
+    fstat(fd, &fs);
+    // Once it is complete, the file does not need the marker anymore
+    if(written >= fs.st_size / SECTOR_SIZE) {
+      if(writeMarker(fd, -1))
+        marked = false;
+    }
+    else
+      writeMarker(fd, written);
+  }
+}
 
-void DVDOutFile::writeSectors(const char * data, size_t number)
+void DVDOutFile::wrote(int pos, size_t number)
+{
+  // Only the sectors following the ones already written count, since
+  // the marker can only say that the beginning of the file is there.
+  if(pos <= written)
+    written = std::max(written, pos + (int) number);
+  if(marked && written - checkpointed >= CHECKPOINT_INTERVAL)
+    checkpoint();
+}
+
+unsigned char * DVDOutFile::mappedSectors(size_t number)
 {
+  if(! useMap)
+    return NULL;
   if(fd < 0)
     openFile();
   int cur_sect_pos = sector % MAX_FILE_SIZE;
-  if(cur_sect_pos + number <= MAX_FILE_SIZE) {
+  // Only the sectors already in the file are mapped: it is only
+  // extended beforehand when it carries a marker (see finalSize), so
+  // that its size never covers sectors that were not read.
+  if(cur_sect_pos + (int) number > mappedFileSize)
+    return NULL;
+
+  if(! map || cur_sect_pos < mapStart || 
+     cur_sect_pos + (int) number > mapStart + mapSize) {
+    unmap();
+    mapStart = cur_sect_pos - cur_sect_pos % MAP_WINDOW;
+    mapSize = MAP_WINDOW;
+    while(cur_sect_pos + (int) number > mapStart + mapSize)
+      mapSize += MAP_WINDOW;
+    mapSize = std::min(mapSize, mappedFileSize - mapStart);
+    void * ptr = mmap(NULL, (size_t) mapSize * SECTOR_SIZE, 
+                      PROT_READ|PROT_WRITE, MAP_SHARED, fd, 
+                      (off_t) mapStart * SECTOR_SIZE);
+    if(ptr == MAP_FAILED) {
+      // We just write normally from now on
+      useMap = false;
+      lseek(fd, SECTOR_SIZE * (off_t) cur_sect_pos, SEEK_SET);
+      return NULL;
+    }
+    map = static_cast<unsigned char *>(ptr);
+    madvise(map, (size_t) mapSize * SECTOR_SIZE, MADV_SEQUENTIAL);
+  }
+  return map + (size_t) (cur_sect_pos - mapStart) * SECTOR_SIZE;
+}
+
+
+void DVDOutFile::writeSectors(const char * data, size_t number)
+{
+  int cur_sect_pos = sector % MAX_FILE_SIZE;
+  if(cur_sect_pos + (int) number <= MAX_FILE_SIZE) {
     /* Simple case */
-    write(fd, data, number * SECTOR_SIZE);
+    STATS_TIMER(WriteSectors);
+    Trace::Span span("write", "write");
+    span.set("sector", sector).set("sectors", (int) number);
+    if(fd < 0)
+      openFile();
+    if(rateLimiter)
+      rateLimiter->consume(number * SECTOR_SIZE);
+    std::chrono::steady_clock::time_point before;
+    if(Metrics::enabled())
+      before = std::chrono::steady_clock::now();
+    unsigned char * target = mappedSectors(number);
+    if(target) {
+      if(target != reinterpret_cast<const unsigned char *>(data))
+        memcpy(target, data, number * SECTOR_SIZE);
+      // Same as sync_file_range() below, for the mapping
+      if(rateLimiter) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t offset = (size_t) (target - map);
+        size_t begin = offset - offset % page;
+        msync(map + begin, offset + number * SECTOR_SIZE - begin, 
+              MS_ASYNC);
+      }
+    }
+    else {
+      if(useMap)                // The file position is not up-to-date
+        lseek(fd, SECTOR_SIZE * (off_t) cur_sect_pos, SEEK_SET);
+      write(fd, data, number * SECTOR_SIZE);
+      if(useMap)
+        mappedFileSize = std::max(mappedFileSize, 
+                                  cur_sect_pos + (int) number);
+#ifdef HAVE_SYNC_FILE_RANGE
+      // When the output is limited, the data is sent to the disk as it
+      // comes, rather than in large bursts when the kernel flushes
+      // its cache.
+      if(rateLimiter)
+        sync_file_range(fd, SECTOR_SIZE * (off_t) cur_sect_pos, 
+                        number * SECTOR_SIZE, SYNC_FILE_RANGE_WRITE);
+#endif
+    }
+    if(Metrics::enabled()) {
+      std::chrono::duration<double> elapsed = 
+        std::chrono::steady_clock::now() - before;
+      Metrics::written(number * SECTOR_SIZE, elapsed.count());
+    }
+    wrote(cur_sect_pos, number);
     sector += number;
 
     /* If we reached the end of file, we switch to the next one. */
@@ -99,8 +307,108 @@ void DVDOutFile::writeSectors(const char * data, size_t number)
   }
 }
 
+size_t DVDOutFile::copyFrom(int in, long start, size_t number)
+{
+  size_t done = 0;
+#ifdef HAVE_COPY_FILE_RANGE
+  if(fd < 0)
+    openFile();
+  // The mapping does not know about the data written there, see below
+  unmap();
+  while(done < number) {
+    int cur_sect_pos = sector % MAX_FILE_SIZE;
+    size_t nb = std::min(number - done, 
+                         (size_t) (MAX_FILE_SIZE - cur_sect_pos));
+    loff_t inPos = (loff_t) (start + done) * SECTOR_SIZE;
+    loff_t outPos = (loff_t) cur_sect_pos * SECTOR_SIZE;
+    size_t left = nb * SECTOR_SIZE;
+    if(rateLimiter)
+      rateLimiter->consume(left);
+    Trace::Span span("copy_file_range", "write");
+    span.set("source-sector", (long long) (start + done)).
+      set("sector", sector).set("sectors", (int) nb);
+    std::chrono::steady_clock::time_point before;
+    if(Metrics::enabled())
+      before = std::chrono::steady_clock::now();
+    while(left > 0) {
+      ssize_t cp = copy_file_range(in, &inPos, fd, &outPos, left, 0);
+      if(cp <= 0)
+        break;
+      left -= cp;
+    }
+    if(Metrics::enabled()) {
+      std::chrono::duration<double> elapsed = 
+        std::chrono::steady_clock::now() - before;
+      Metrics::written(nb * SECTOR_SIZE - left, elapsed.count());
+    }
+    // We only count whole sectors
+    size_t copied = nb - (left + SECTOR_SIZE - 1) / SECTOR_SIZE;
+#ifdef HAVE_SYNC_FILE_RANGE
+    // Same as in writeSectors()
+    if(rateLimiter && copied > 0)
+      sync_file_range(fd, SECTOR_SIZE * (off_t) cur_sect_pos, 
+                      copied * SECTOR_SIZE, SYNC_FILE_RANGE_WRITE);
+#endif
+    wrote(cur_sect_pos, copied);
+    done += copied;
+    sector += copied;
+    if(copied < nb) {
+      lseek(fd, SECTOR_SIZE * (off_t) (sector % MAX_FILE_SIZE), SEEK_SET);
+      break;
+    }
+    if(sector % MAX_FILE_SIZE == 0)
+      openFile();
+    else
+      lseek(fd, SECTOR_SIZE * (off_t) (sector % MAX_FILE_SIZE), SEEK_SET);
+  }
+  if(useMap) {
+    struct stat fs;
+    fstat(fd, &fs);
+    mappedFileSize = fs.st_size / SECTOR_SIZE;
+  }
+#endif
+  return done;
+}
+
+void DVDOutFile::setIOPriority(const char * spec)
+{
+#if defined(HAVE_LINUX_IOPRIO_H) && defined(SYS_ioprio_set)
+  std::string s(spec);
+  std::string cls = s.substr(0, s.find(':'));
+  int level = 4;
+  if(cls.size() < s.size())
+    level = atoi(s.c_str() + cls.size() + 1);
+  int c;
+  if(cls == "idle") {
+    c = IOPRIO_CLASS_IDLE;
+    level = 0;
+  }
+  else if(cls == "best-effort")
+    c = IOPRIO_CLASS_BE;
+  else if(cls == "realtime")
+    c = IOPRIO_CLASS_RT;
+  else
+    throw std::runtime_error("Unknown I/O priority class: '" + cls + "'");
+  if(level < 0 || level > 7)
+    throw std::runtime_error("The I/O priority level must be between "
+                             "0 and 7");
+  // IOPRIO_WHO_PROCESS with 0 is the calling thread, whose priority
+  // is inherited by the threads started afterwards.
+  if(syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, 
+             IOPRIO_PRIO_VALUE(c, level)) < 0) {
+    std::string err("Failed to set the I/O priority: ");
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+#else
+  throw std::runtime_error("Setting the I/O priority is not supported "
+                           "on this system");
+#endif
+}
+
 void DVDOutFile::closeFile()
 {
+  unmap();
   if(fd >= 0)
     close(fd);
   fd = -1;
@@ -125,6 +433,14 @@ static char empty_sector[2048] = {0, 0, 0, 0};
 
 void DVDOutFile::skipSectors(size_t number)
 {
+  // The mapped sectors may hold whatever was read into them, so they
+  // are cleared too.
+  unsigned char * target = mappedSectors(number);
+  if(target) {
+    memset(target, 0, number * SECTOR_SIZE);
+    writeSectors(reinterpret_cast<char *>(target), number);
+    return;
+  }
   /// @todo Possibly we should fill this with relevant information ?
   while(number--)
     writeSectors(empty_sector, 1);
@@ -133,7 +449,6 @@ void DVDOutFile::skipSectors(size_t number)
 size_t DVDOutFile::fileSize() const
 {
   int cur;
-  struct stat fs;
   std::string name;
   switch(domain) {
   case DVD_READ_INFO_FILE:
@@ -141,27 +456,40 @@ size_t DVDOutFile::fileSize() const
   case DVD_READ_MENU_VOBS:
     /* The simple case:  */
     name = outputFileName(0);
-    if(stat(name.c_str(), &fs) == -1)
-      return 0;
-    return fs.st_size/2048;
+    return std::max(writtenSectors(name), 0);
     break;
   case DVD_READ_TITLE_VOBS:
     /* The delicate one. */
     cur = 1;
     while(1) {
       name = outputFileName(cur);
-      if(stat(name.c_str(), &fs) == -1)
+      int nb = writtenSectors(name);
+      if(nb < 0)
 	return (cur - 1)*512*1024;
-      if(fs.st_size < (1024 * 1024 * 1024))
-	return (cur - 1)*512*1024 + fs.st_size/2048;
+      if(nb < MAX_FILE_SIZE)
+	return (cur - 1)*512*1024 + nb;
       cur += 1;
     }
   }
   return 0;
 }
 
+int DVDOutFile::writtenSectors(const std::string & file)
+{
+  struct stat fs;
+  if(stat(file.c_str(), &fs) == -1)
+    return -1;
+  int marker = readMarker(-1, file.c_str());
+  if(marker >= 0)
+    return marker;
+  return fs.st_size / SECTOR_SIZE;
+}
+
 void DVDOutFile::seek(int s)
 {
   sector = s;
-  openFile();
+  if(fd >= 0 && openedNumber == sector / MAX_FILE_SIZE)
+    lseek(fd, SECTOR_SIZE * (off_t) (sector % MAX_FILE_SIZE), SEEK_SET);
+  else
+    openFile();
 }
@@ -20,6 +20,12 @@
 #ifndef __DVDOUTFILE_H
 #define __DVDOUTFILE_H
 
+class RateLimiter;
+
+/** The maximum size of an output file, in sectors */
+#define MAX_FILE_SIZE (512*1024)
+#define SECTOR_SIZE 2048
+
 /// Handles writing output files.
 class DVDOutFile {
   /// Output file descriptor
@@ -37,6 +43,40 @@ class DVDOutFile {
   /// Current sector (one DVD sector is 2048 bytes)
   int sector;
 
+  /// The number of the file currently opened (see makeFileName())
+  int openedNumber;
+
+  /// The part of the opened file currently mapped in memory, or NULL
+  unsigned char * map;
+
+  /// The position of the mapping in the file, in sectors
+  int mapStart;
+
+  /// The size of the mapping, in sectors
+  int mapSize;
+
+  /// The size of the opened file, in sectors, when it is mapped
+  int mappedFileSize;
+
+  /// Whether the opened file carries a marker with the number of
+  /// sectors written so far (see finalSize)
+  bool marked;
+
+  /// The number of sectors at the beginning of the opened file that
+  /// were written, when it is marked
+  int written;
+
+  /// The value of written at the last checkpoint()
+  int checkpointed;
+
+  /// Checkpoints (see checkpoint()), and unmaps the current mapping,
+  /// if any.
+  void unmap();
+
+  /// Tells that @a number sectors were written at @a pos in the
+  /// opened file.
+  void wrote(int pos, size_t number);
+
   /// Returns the numbered base file
   std::string makeFileName(int number = -1) const;
 
@@ -57,6 +97,12 @@ public:
   /// number of bytes.
   void writeSectors(const char * data, size_t number);
 
+  /// Copies @a number sectors from the file descriptor @a in,
+  /// starting at the sector @a start, to the current position,
+  /// without going through user space. Returns the number of sectors
+  /// copied, which is less than @a number if this is not possible.
+  size_t copyFrom(int in, long start, size_t number);
+
   /// Closes the output file
   void closeFile();
 
@@ -71,9 +117,59 @@ public:
   /// file.
   size_t fileSize() const;
 
-  /// Seeks to the given sector:
+  /// Returns the number of sectors written to the given file, which
+  /// is its size unless it was extended beforehand (see finalSize),
+  /// or -1 if it does not exist.
+  static int writtenSectors(const std::string & file);
+
+  /// Seeks to the given sector. The output file is only reopened if
+  /// the sector is not in the currently opened one.
   void seek(int sector);
 
+  /// Returns the current sector
+  int currentSector() const {
+    return sector;
+  };
+
+  /// If true, the output file is written through a memory mapping,
+  /// which makes it possible to read sectors directly into the file
+  /// (see mappedSectors()). It must be set before writing anything.
+  bool useMap;
+
+  /// The final size of the output, in sectors (for title VOBs, of
+  /// all the parts together), or 0 if unknown.
+  ///
+  /// When it is set along with useMap, the files are extended to
+  /// their final size as they are opened, so that all the sectors can
+  /// be mapped. Until they are complete, they carry a marker (an
+  /// extended attribute) with the number of sectors written so far,
+  /// updated at each checkpoint(), which writtenSectors() and
+  /// fileSize() return rather than the size of the file.
+  int finalSize;
+
+  /// If useMap is true, returns where the @a number sectors from the
+  /// current position are in memory, so that they can be read
+  /// directly there. Passing the returned pointer to writeSectors()
+  /// then just moves on without copying anything. Returns NULL when
+  /// this is not possible, for instance if the sectors span two
+  /// files or go past the end of the file (see finalSize).
+  unsigned char * mappedSectors(size_t number);
+
+  /// Makes sure the sectors written through the mapping are on the
+  /// disk, before they are accounted for in the bad sectors file, and
+  /// updates the marker of the file.
+  void checkpoint();
+
+  /// If not NULL, limits the rate at which all the output files
+  /// are written.
+  static RateLimiter * rateLimiter;
+
+  /// Sets the I/O priority of the process (and of the threads it
+  /// starts afterwards), from a @a spec of the form CLASS[:LEVEL],
+  /// where CLASS is idle, best-effort or realtime, and LEVEL goes from
+  /// 0 (highest) to 7.
+  static void setIOPriority(const char * spec);
+
   ~DVDOutFile();
 
   /// Returns the file name for the given attributes
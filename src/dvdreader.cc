@@ -206,6 +206,7 @@ std::vector<DVDFileData *> DVDReader::listFiles()
   for(std::vector<DVDFileData *>::iterator i = retval.begin(); 
       i != retval.end(); i++) {
     DVDFileData * dat = *i;
+    dat->index = i - retval.begin();
     std::map<unsigned long, DVDFileData *>::iterator j = 
       dups.find(dat->fileID);
     if(j != dups.end())
@@ -50,10 +50,14 @@ public:
   /// @warning Not used for now.
   uint32_t relevantSize;
 
+  /// The position of the file in the list of the files of the disc
+  /// (see DVDReader::listFiles()), or -1.
+  int index;
+
 
   DVDFileData(int t, dvd_read_domain_t d, 
               int n) : title(t), domain(d), number(n), 
-                       dup(NULL), relevantSize(0) {;};
+                       dup(NULL), relevantSize(0), index(-1) {;};
 
   std::string fileName(bool stripInitialSlash = false, 
                        int blocks = -1) const;
@@ -117,6 +121,11 @@ public:
   /// Returns the dvd_reader_t handle.
   dvd_reader_t * handle() const;
 
+  /// Whether the source is a directory
+  bool isDirectory() const {
+    return isDir;
+  };
+
 
   ~DVDReader();
 };
@@ -0,0 +1,296 @@
+/**
+    \file dvdsource.cc
+    Implementation of the DVDSource class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "dvdsource.hh"
+#include "dvdfile.hh"
+#include "simulateddrive.hh"
+#include "sessionlog.hh"
+#include "trace.hh"
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+DVDSource::DVDSource(const char * dev) : reader(NULL), imageFD(-1),
+                                         device(dev), directAccess(true),
+                                         queueDepth(0)
+{
+  DVDReader r(dev);
+  files = r.listFiles();
+  isDirectory = r.isDirectory();
+  struct stat sb;
+  isImage = (stat(dev, &sb) == 0 && S_ISREG(sb.st_mode));
+  onDrive = isDirectory && (stat(dev, &sb) != 0 || 
+                            isRemovableDevice(sb.st_dev));
+
+  {
+    // This is where the disc key is fetched
+    Trace::Span span("DVDOpen", "open,css");
+    span.set("device", device);
+    reader = DVDOpen(dev);
+  }
+  if(! reader) {
+    std::string err("Error opening device ");
+    err += dev;
+    throw std::runtime_error(err);
+  }
+}
+
+bool DVDSource::isRemovableDevice(dev_t dev)
+{
+  // SCSI CD-ROM drives
+  if(major(dev) == 11)
+    return true;
+  char buf[100];
+  // The flag is on the disk, not on its partitions.
+  const char * names[] = { "removable", "../removable" };
+  for(const char * name : names) {
+    snprintf(buf, sizeof(buf), "/sys/dev/block/%u:%u/%s", 
+             major(dev), minor(dev), name);
+    FILE * f = fopen(buf, "r");
+    if(! f)
+      continue;
+    int removable = 0;
+    if(fscanf(f, "%d", &removable) != 1)
+      removable = 0;
+    fclose(f);
+    return removable != 0;
+  }
+  return false;
+}
+
+DVDSource::~DVDSource()
+{
+  closeFiles();
+  if(reader)
+    DVDClose(reader);
+  if(imageFD >= 0)
+    close(imageFD);
+  for(std::vector<DVDFileData *>::iterator i = files.begin(); 
+      i != files.end(); i++)
+    delete *i;                  // Keep it clean;
+}
+
+bool DVDSource::isSeekFree() const
+{
+  return ((isDirectory && ! onDrive) || isImage) && ! simulatedDrive && 
+    ! replayedDrive && ! recorder;
+}
+
+void DVDSource::closeFiles()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  for(auto it = openedFiles.begin(); it != openedFiles.end(); ++it)
+    delete it->second;
+  openedFiles.clear();
+}
+
+DVDFile * DVDSource::openFile(const DVDFileData * dat)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::pair<int, dvd_read_domain_t> key(dat->title, dat->domain);
+  auto it = openedFiles.find(key);
+  if(it != openedFiles.end())
+    return it->second;
+  DVDFile * file = openPlainFile(dat);
+  if(! file) {
+    file = DVDFile::openFile(reader, dat);
+    if(file)
+      file->readerMutex = &mutex;
+  }
+  if(file && simulatedDrive)
+    file = new DVDSimulatedFile(file, simulatedDrive.get(), dat);
+  if(file && replayedDrive)
+    file = new DVDReplayedFile(file, replayedDrive.get(), dat);
+  if(file && recorder)
+    file = new DVDRecordingFile(file, recorder.get(), dat);
+  openedFiles[key] = file;
+  return file;
+}
+
+/// Whether the sector belongs to a CSS-scrambled stream: for the
+/// audio and video PES packets, this is the same test as in
+/// libdvdcss.
+static bool isScrambled(const unsigned char * buffer)
+{
+  unsigned char stream = buffer[17];
+  if(! (buffer[14] == 0 && buffer[15] == 0 && buffer[16] == 1))
+    return false;
+  if(stream == 0xbd || (stream >= 0xc0 && stream <= 0xef))
+    return buffer[0x14] & 0x30;
+  return false;
+}
+
+DVDFile * DVDSource::openPlainFile(const DVDFileData * dat)
+{
+  if(! directAccess || ! (isDirectory || isImage))
+    return NULL;
+
+  std::vector<DVDPlainFile::Extent> extents;
+  if(isDirectory) {
+    // All the parts, for title VOBs
+    for(const DVDFileData * f : files) {
+      if(f->title != dat->title || f->domain != dat->domain || 
+         f->number < dat->number)
+        continue;
+      std::string name = device + f->fileName();
+      int fd = open(name.c_str(), O_RDONLY);
+      if(fd < 0) {
+        for(const DVDPlainFile::Extent & e : extents)
+          close(e.fd);
+        return NULL;
+      }
+      extents.push_back(DVDPlainFile::Extent(fd, 0, f->size/2048));
+    }
+  }
+  else {
+    // In images, the parts of title VOBs follow each other, which is
+    // how libdvdread reads them too.
+    if(imageFD < 0)
+      imageFD = open(device.c_str(), O_RDONLY);
+    if(imageFD < 0)
+      return NULL;
+    int size = 0;
+    for(const DVDFileData * f : files)
+      if(f->title == dat->title && f->domain == dat->domain && 
+         f->number >= dat->number)
+        size += f->size/2048;
+    int fd = dup(imageFD);
+    if(fd < 0)
+      return NULL;
+    extents.push_back(DVDPlainFile::Extent(fd, dat->fileID, size));
+  }
+  if(extents.empty())
+    return NULL;
+
+  std::unique_ptr<DVDPlainFile> file(new DVDPlainFile(extents, dat));
+
+  // The VOB files of images, and of directories where a disc is
+  // mounted, may be encrypted, in which case only libdvdread
+  // (through libdvdcss) can read them. We look at a few sectors
+  // throughout the file.
+  if(dat->domain == DVD_READ_MENU_VOBS || 
+     dat->domain == DVD_READ_TITLE_VOBS) {
+    SectorBuffer buffer = SectorArena::global().allocate(1);
+    int size = file->fileSize();
+    const int samples = 64;
+    for(int i = 0; i < samples; i++) {
+      int sector = (i < 16 ? i : (long) size * i / samples);
+      if(sector >= size)
+        break;
+      if(file->readBlocks(sector, 1, buffer.data()) != 1 || 
+         isScrambled(buffer.data()))
+        return NULL;
+    }
+  }
+  if(queueDepth > 0 && ! file->setQueueDepth(queueDepth)) {
+    printf("io_uring is not available, reading %s synchronously\n",
+           dat->fileName().c_str());
+    queueDepth = 0;
+  }
+  return file.release();
+}
+
+long DVDSource::physicalSector(const DVDFileData * dat, int sector) const
+{
+  long base = 0;
+  for(const DVDFileData * f : files) {
+    if(f->dup)
+      continue;
+    long sz = f->size/2048;
+    if(f->title == dat->title && f->domain == dat->domain &&
+       f->number >= dat->number) {
+      // We are within the file, or one of its later parts for title
+      // VOBs, whose sectors are numbered from the first part.
+      if(sector < sz || f->domain != DVD_READ_TITLE_VOBS)
+        return (isDirectory ? base : f->fileID) + sector;
+      sector -= sz;
+    }
+    base += sz;
+  }
+  // Should not happen, but, well...
+  return base + sector;
+}
+
+void DVDSource::simulateDrive(const std::string & spec, int stream)
+{
+  simulatedDrive.reset(new SimulatedDrive(spec, stream));
+}
+
+void DVDSource::recordSession(const std::string & file)
+{
+  closeFiles();
+  recorder.reset();
+  std::string fp = fingerprint();
+  closeFiles();
+  recorder.reset(new SessionRecorder(file, fp));
+}
+
+void DVDSource::replaySession(const std::string & file, double speed)
+{
+  closeFiles();
+  replayedDrive.reset();
+  std::string fp = fingerprint();
+  closeFiles();
+  replayedDrive.reset(new ReplayedDrive(file, fp));
+  replayedDrive->speed = speed;
+}
+
+/// 64-bits FNV-1a hash
+static void hashBytes(uint64_t * hash, const unsigned char * data, size_t nb)
+{
+  for(size_t i = 0; i < nb; i++) {
+    *hash ^= data[i];
+    *hash *= 0x100000001b3ULL;
+  }
+}
+
+std::string DVDSource::fingerprint()
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  SectorBuffer buffer = SectorArena::global().allocate(1);
+  for(const DVDFileData * f : files) {
+    std::string name = f->fileName();
+    hashBytes(&hash, reinterpret_cast<const unsigned char *>(name.c_str()),
+              name.size());
+    hashBytes(&hash, reinterpret_cast<const unsigned char *>(&f->size),
+              sizeof(f->size));
+    if(f->domain != DVD_READ_INFO_FILE)
+      continue;
+    DVDFile * file = openFile(f);
+    if(! file)
+      continue;
+    int sz = file->fileSize();
+    for(int i = 0; i < sz; i++) {
+      if(file->readBlocks(i, 1, buffer.data()) != 1) {
+        std::string err = "Could not read " + f->fileName() + 
+          " on " + device + " to identify the disc";
+        throw std::runtime_error(err);
+      }
+      hashBytes(&hash, buffer.data(), 2048);
+    }
+  }
+  char buf[30];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) hash);
+  return buf;
+}
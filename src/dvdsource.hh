@@ -0,0 +1,150 @@
+/**
+    \file dvdsource.hh
+    The DVDSource class, representing a source being read
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DVDSOURCE_H
+#define __DVDSOURCE_H
+
+#include "dvdreader.hh"
+
+class DVDFile;
+class SimulatedDrive;
+class SessionRecorder;
+class ReplayedDrive;
+
+/// A source being read (a device, an image or a directory), along
+/// with its list of files and the files opened so far.
+class DVDSource {
+  /// The reader
+  dvd_reader_t * reader;
+
+  /// The files opened so far, indexed by title and domain. They stay
+  /// open as long as the source is used, since, on encrypted discs,
+  /// opening a file means getting its title key all over again.
+  std::map<std::pair<int, dvd_read_domain_t>, DVDFile *> openedFiles;
+
+  /// If not NULL, the errors of the source are simulated using this
+  /// object.
+  std::unique_ptr<SimulatedDrive> simulatedDrive;
+
+  /// If not NULL, the source behaves as recorded in a session log
+  /// (see ReplayedDrive).
+  std::unique_ptr<ReplayedDrive> replayedDrive;
+
+  /// If not NULL, the reads of the source are recorded (see
+  /// SessionRecorder).
+  std::unique_ptr<SessionRecorder> recorder;
+
+  /// The file descriptor of the image, for direct access, or -1.
+  int imageFD;
+
+  /// Whether the source is an image file
+  bool isImage;
+
+  /// Whether the source is a directory on a removable device, such
+  /// as the mount point of a disc.
+  bool onDrive;
+
+  /// Whether the block device @a dev is removable, or a CD-ROM drive.
+  static bool isRemovableDevice(dev_t dev);
+
+  /// Protects openedFiles, and the reads through libdvdread, so that
+  /// several threads can read different files of the source.
+  std::mutex mutex;
+
+  /// Returns a DVDPlainFile for the given file, or NULL if the file
+  /// cannot be read directly (because it is encrypted, for instance).
+  DVDFile * openPlainFile(const DVDFileData * dat);
+
+  /// Closes the files opened so far, so that they are opened again
+  /// through the simulations and the recording.
+  void closeFiles();
+
+public:
+
+  /// The device, image or directory
+  std::string device;
+
+  /// The files of the source
+  std::vector<DVDFileData *> files;
+
+  /// Whether the source is a directory (as opposed to a device or an
+  /// image)
+  bool isDirectory;
+
+  /// Whether the files of directories and unencrypted images are read
+  /// directly from the file system, rather than through libdvdread
+  /// (true by default). It should be set before opening any file.
+  bool directAccess;
+
+  /// When positive, the files read directly keep that many chunks
+  /// read ahead in flight using io_uring (see
+  /// DVDPlainFile::setQueueDepth()). It should be set before opening
+  /// any file.
+  int queueDepth;
+
+  /// Whether several files of the source can be read at the same
+  /// time without slowing things down, ie whether there is no drive
+  /// whose head would go back and forth between them. This is the
+  /// case for images and directories (unless they are on a
+  /// removable device, a drive is simulated or replayed, or the reads
+  /// are recorded).
+  bool isSeekFree() const;
+
+  /// Opens the given source, and lists its files
+  DVDSource(const char * device);
+
+  /// Returns the opened DVDFile for the given file, opening it if
+  /// necessary. The returned object belongs to the DVDSource, and it
+  /// can be NULL if the file could not be opened.
+  ///
+  /// This function is thread-safe, and so are the reads from
+  /// different returned files.
+  DVDFile * openFile(const DVDFileData * dat);
+
+  /// Returns the position of the given sector of the given file on
+  /// the source, using the start sectors of the files. For
+  /// directories, where there is no such thing, the files are assumed
+  /// to follow each other in the order of the list of files.
+  long physicalSector(const DVDFileData * dat, int sector) const;
+
+  /// Simulates the errors of a damaged disc in a drive with a cache
+  /// on top of the real source (see SimulatedDrive). @a stream is
+  /// used to get different random numbers for different sources.
+  void simulateDrive(const std::string & spec, int stream = 0);
+
+  /// Records all the reads in the session log @a file (see
+  /// SessionRecorder), which is added to if it already holds a
+  /// session for the same disc.
+  void recordSession(const std::string & file);
+
+  /// Replays the session recorded in @a file on top of the real
+  /// source (see ReplayedDrive), which should hold the same disc (a
+  /// copy, for instance). The reads are slowed down to their recorded
+  /// time divided by @a speed when it is positive.
+  void replaySession(const std::string & file, double speed = 0);
+
+  /// Returns a fingerprint of the contents of the disc, based on the
+  /// list of files, their sizes, and the contents of the IFO files.
+  /// Two sources with the same fingerprint hold the same disc.
+  std::string fingerprint();
+
+  ~DVDSource();
+};
+
+#endif
@@ -0,0 +1,164 @@
+/**
+    \file eventlog.cc
+    Implementation of the EventLog class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "headers.hh"
+#include "eventlog.hh"
+
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/time.h>
+
+EventLog * EventLog::log = NULL;
+
+EventLog::EventLog(int f) : fd(f)
+{
+}
+
+void EventLog::open(int fd, const std::string & format)
+{
+  if(format != "json")
+    throw std::runtime_error("Unknown event format: '" + format + "'");
+  if(fcntl(fd, F_GETFD) < 0) {
+    std::string err("Cannot write events: ");
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  // The reader going away must not kill us: the writes just fail
+  // then (see emit()).
+  signal(SIGPIPE, SIG_IGN);
+  log = new EventLog(fd);
+}
+
+void EventLog::emit(const Event & event)
+{
+  if(! log)
+    return;
+  std::string line = event.toJSON() + "\n";
+  std::lock_guard<std::mutex> lock(log->mutex);
+  size_t done = 0;
+  while(done < line.size()) {
+    ssize_t nb = write(log->fd, line.c_str() + done, line.size() - done);
+    if(nb < 0 && errno == EINTR)
+      continue;
+    if(nb <= 0)                 // Nobody listens anymore
+      return;
+    done += nb;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+
+EventLog::Event::Event(const char * type) : json("{")
+{
+  if(! type)
+    return;
+  set("event", type);
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  char buffer[40];
+  snprintf(buffer, sizeof(buffer), "%ld.%03ld", (long) now.tv_sec,
+           (long) now.tv_usec / 1000);
+  addKey("time");
+  json += buffer;
+}
+
+void EventLog::Event::addKey(const char * key)
+{
+  if(json.size() > 1)
+    json += ",";
+  json += "\"";
+  json += key;
+  json += "\":";
+}
+
+EventLog::Event & EventLog::Event::set(const char * key, 
+                                       const std::string & value)
+{
+  addKey(key);
+  json += "\"";
+  for(char c : value) {
+    switch(c) {
+    case '"':
+      json += "\\\"";
+      break;
+    case '\\':
+      json += "\\\\";
+      break;
+    case '\n':
+      json += "\\n";
+      break;
+    default:
+      if((unsigned char) c < 0x20) {
+        char buffer[10];
+        snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+        json += buffer;
+      }
+      else
+        json += c;
+    }
+  }
+  json += "\"";
+  return *this;
+}
+
+EventLog::Event & EventLog::Event::set(const char * key, const char * value)
+{
+  return set(key, std::string(value));
+}
+
+EventLog::Event & EventLog::Event::set(const char * key, int value)
+{
+  return set(key, (long long) value);
+}
+
+EventLog::Event & EventLog::Event::set(const char * key, long long value)
+{
+  addKey(key);
+  json += std::to_string(value);
+  return *this;
+}
+
+EventLog::Event & EventLog::Event::set(const char * key, double value)
+{
+  addKey(key);
+  if(isfinite(value)) {
+    char buffer[40];
+    snprintf(buffer, sizeof(buffer), "%.6g", value);
+    json += buffer;
+  }
+  else
+    json += "null";
+  return *this;
+}
+
+EventLog::Event & EventLog::Event::set(const char * key, bool value)
+{
+  addKey(key);
+  json += value ? "true" : "false";
+  return *this;
+}
+
+std::string EventLog::Event::toJSON() const
+{
+  return json + "}";
+}
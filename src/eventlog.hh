@@ -0,0 +1,85 @@
+/**
+    \file eventlog.hh
+    A machine-readable stream of events
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __EVENTLOG_H
+#define __EVENTLOG_H
+
+/// A stream of events describing what dvdcopy is doing (passes and
+/// files started and finished, chunks read, errors, retries and
+/// progress), for other programs to follow. Each event is a JSON
+/// object on its own line, with at least an "event" and a "time"
+/// (in seconds since the epoch) member.
+///
+/// Events are only written once the log is opened with open(); the
+/// code emitting them should check enabled() first, so that they cost
+/// nothing otherwise.
+class EventLog {
+  /// Where the events go
+  int fd;
+
+  /// So that the events of different threads do not mix
+  std::mutex mutex;
+
+  EventLog(int fd);
+
+  /// The opened log, or NULL
+  static EventLog * log;
+
+public:
+
+  /// An event being built
+  class Event {
+    /// The JSON object, without its closing brace
+    std::string json;
+
+    /// Adds the key, before its value
+    void addKey(const char * key);
+
+  public:
+    /// Starts an event of the given @a type, or just an empty JSON
+    /// object if @a type is NULL (see Trace::Span).
+    Event(const char * type);
+
+    /// Adds a member to the event.
+    Event & set(const char * key, const std::string & value);
+    Event & set(const char * key, const char * value);
+    Event & set(const char * key, int value);
+    Event & set(const char * key, long long value);
+    Event & set(const char * key, double value);
+    Event & set(const char * key, bool value);
+
+    /// The complete JSON object
+    std::string toJSON() const;
+  };
+
+  /// Whether events are written
+  static bool enabled() {
+    return log != NULL;
+  };
+
+  /// Writes the event, if the log is opened.
+  static void emit(const Event & event);
+
+  /// Writes the events to @a fd from now on, in the given @a format
+  /// (only "json" for now).
+  static void open(int fd, const std::string & format = "json");
+};
+
+#endif
@@ -0,0 +1,319 @@
+/**
+    \file flightrecorder.cc
+    Implementation of the FlightRecorder class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "headers.hh"
+#include "flightrecorder.hh"
+#include "dvdreader.hh"
+
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+
+/// The number of events kept
+#define RING_SIZE 4096
+
+/// The size of the text of the events
+#define TEXT_SIZE 24
+
+/// An event in the ring buffer. The @a seq member is 0 while the
+/// event is being written, and then the number of the event plus 1,
+/// so that the dump can skip events that are not complete.
+struct FlightEvent {
+  std::atomic<uint64_t> seq;
+  /// In microseconds since the epoch
+  int64_t time;
+  int32_t sector;
+  int32_t count;
+  /// In microseconds
+  uint32_t latency;
+  int16_t title;
+  int8_t domain;
+  uint8_t type;
+  char text[TEXT_SIZE];
+};
+
+static FlightEvent ring[RING_SIZE];
+
+/// The number of the next event
+static std::atomic<uint64_t> nextEvent(0);
+
+/// Where the events are written. The strings are never modified nor
+/// freed, so that the signal handler can use them whatever the
+/// threads setting the file do.
+static std::atomic<const char *> fileName(NULL);
+
+/// Whether fileName was given with setFile()
+static std::atomic<bool> explicitFile(false);
+
+/// The size of the alternate stack of the signal handler
+#define ALT_STACK_SIZE 65536
+
+/// The alternate stack of the signal handler for one thread
+class AltStack {
+  char * stack;
+public:
+  AltStack() {
+    stack = new char[ALT_STACK_SIZE];
+    stack_t st;
+    st.ss_sp = stack;
+    st.ss_size = ALT_STACK_SIZE;
+    st.ss_flags = 0;
+    sigaltstack(&st, NULL);
+  };
+
+  ~AltStack() {
+    stack_t st;
+    memset(&st, 0, sizeof(st));
+    st.ss_flags = SS_DISABLE;
+    sigaltstack(&st, NULL);
+    delete[] stack;
+  };
+};
+
+void FlightRecorder::record(Type type, const DVDFileData * file, 
+                            int sector, int count, double latency,
+                            const char * text)
+{
+  uint64_t i = nextEvent.fetch_add(1, std::memory_order_relaxed);
+  FlightEvent & e = ring[i % RING_SIZE];
+  e.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  e.time = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  e.sector = sector;
+  e.count = count;
+  e.latency = latency > 0 ? std::min(latency * 1e6, 4e9) : 0;
+  e.title = file ? file->title : -1;
+  e.domain = file ? file->domain : -1;
+  e.type = type;
+  if(text) {
+    strncpy(e.text, text, TEXT_SIZE - 1);
+    e.text[TEXT_SIZE - 1] = 0;
+  }
+  else
+    e.text[0] = 0;
+  e.seq.store(i + 1, std::memory_order_release);
+}
+
+void FlightRecorder::setFile(const std::string & file)
+{
+  fileName = strdup(file.c_str());
+  explicitFile = true;
+}
+
+void FlightRecorder::setDefaultFile(const std::string & file)
+{
+  if(explicitFile)
+    return;
+  // The previous name is leaked on purpose, since the signal handler
+  // may be using it.
+  const char * current = fileName;
+  if(! current || file != current)
+    fileName = strdup(file.c_str());
+}
+
+void FlightRecorder::threadStarted()
+{
+  // The handler must still work when the stack overflows
+  static thread_local AltStack altStack;
+  (void) altStack;
+}
+
+/// Formats the dump with async-signal-safe functions only
+class DumpWriter {
+  int fd;
+  char buffer[4096];
+  size_t size;
+public:
+  DumpWriter(int f) : fd(f), size(0) {;};
+
+  void flush() {
+    size_t done = 0;
+    while(done < size) {
+      ssize_t nb = write(fd, buffer + done, size - done);
+      if(nb < 0 && errno == EINTR)
+        continue;
+      if(nb <= 0)
+        break;
+      done += nb;
+    }
+    size = 0;
+  };
+
+  void add(const char * str) {
+    for(; *str; str++) {
+      if(size == sizeof(buffer))
+        flush();
+      buffer[size++] = *str;
+    }
+  };
+
+  /// Adds the number, padded with zeros to @a width digits
+  void add(long long value, int width = 1) {
+    char digits[24];
+    int nb = 0;
+    bool negative = value < 0;
+    unsigned long long v = negative ? -value : value;
+    do {
+      digits[nb++] = '0' + v % 10;
+      v /= 10;
+    } while(v > 0 || nb < width);
+    if(negative)
+      add("-");
+    char str[24];
+    for(int i = 0; i < nb; i++)
+      str[i] = digits[nb - 1 - i];
+    str[nb] = 0;
+    add(str);
+  };
+
+  ~DumpWriter() {
+    flush();
+  };
+};
+
+static const char * typeNames[] = {
+  "request", "read", "error", "recovered", "retry", "given-up",
+  "file", "phase-start", "phase-end"
+};
+
+void FlightRecorder::dump(int sig)
+{
+  const char * name = fileName;
+  if(! name)
+    return;
+  int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0)
+    return;
+  uint64_t end = nextEvent.load(std::memory_order_acquire);
+  uint64_t begin = end > RING_SIZE ? end - RING_SIZE : 0;
+  {
+    DumpWriter out(fd);
+    out.add("# dvdcopy flight recorder, pid ");
+    out.add(getpid());
+    out.add(", signal ");
+    out.add(sig);
+    out.add(", ");
+    out.add(end - begin);
+    out.add(" events\n# time event file sector count latency-us text\n");
+
+    for(uint64_t i = begin; i < end; i++) {
+      FlightEvent & e = ring[i % RING_SIZE];
+      uint64_t seq = e.seq.load(std::memory_order_acquire);
+      if(seq != i + 1)
+        continue;               // Being written
+      int64_t time = e.time;
+      int sector = e.sector, count = e.count;
+      long latency = e.latency;
+      int title = e.title, domain = e.domain, type = e.type;
+      char text[TEXT_SIZE];
+      memcpy(text, e.text, TEXT_SIZE);
+      text[TEXT_SIZE - 1] = 0;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if(e.seq.load(std::memory_order_relaxed) != seq)
+        continue;               // Overwritten in the meantime
+
+      out.add(time / 1000000);
+      out.add(".");
+      out.add(time % 1000000, 6);
+      out.add(" ");
+      out.add(type >= 0 &&
+              type < (int) (sizeof(typeNames)/sizeof(typeNames[0])) ?
+              typeNames[type] : "?");
+      out.add(" ");
+      if(title < 0)
+        out.add("-");
+      else {
+        if(title == 0)
+          out.add("VIDEO_TS");
+        else {
+          out.add("VTS_");
+          out.add(title, 2);
+        }
+        switch(domain) {
+        case DVD_READ_INFO_FILE:
+          out.add(".IFO");
+          break;
+        case DVD_READ_INFO_BACKUP_FILE:
+          out.add(".BUP");
+          break;
+        case DVD_READ_MENU_VOBS:
+          out.add(".MENU");
+          break;
+        default:
+          out.add(".VOB");
+        }
+      }
+      out.add(" ");
+      out.add(sector);
+      out.add(" ");
+      out.add(count);
+      out.add(" ");
+      out.add(latency);
+      if(text[0]) {
+        out.add(" ");
+        out.add(text);
+      }
+      out.add("\n");
+    }
+  }
+  close(fd);
+}
+
+static void handleSignal(int sig)
+{
+  int saved = errno;
+  FlightRecorder::dump(sig);
+  const char * name = fileName;
+  const char msg[] = "\nWrote the last events to ";
+  if(name && write(2, msg, sizeof(msg) - 1) >= 0 && 
+     write(2, name, strlen(name)) >= 0)
+    write(2, "\n", 1);
+  errno = saved;
+  if(sig != SIGUSR1)
+    raise(sig);                 // With the default handler, now
+}
+
+void FlightRecorder::install()
+{
+  if(! fileName) {
+    char buffer[40];
+    snprintf(buffer, sizeof(buffer), "dvdcopy-%d.flight", (int) getpid());
+    fileName = strdup(buffer);
+  }
+  threadStarted();
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = &handleSignal;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGUSR1, &sa, NULL);
+
+  sa.sa_flags = SA_RESETHAND | SA_ONSTACK;
+  int fatal[] = { SIGTERM, SIGINT, SIGSEGV, SIGBUS, SIGABRT };
+  for(int sig : fatal)
+    sigaction(sig, &sa, NULL);
+}
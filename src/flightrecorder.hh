@@ -0,0 +1,92 @@
+/**
+    \file flightrecorder.hh
+    The last events, dumped when dvdcopy dies or on request
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef __FLIGHTRECORDER_H
+#define __FLIGHTRECORDER_H
+
+#include <stdint.h>
+
+class DVDFileData;
+
+/// Keeps the last events (reads started, reads done, errors,
+/// retries, phase changes), so that they can be written to a file
+/// when dvdcopy gets killed (SIGTERM, SIGINT), crashes (SIGSEGV,
+/// SIGBUS, SIGABRT, which uncaught exceptions end with), or is asked
+/// to with SIGUSR1, to see what it was doing, for instance when a
+/// drive hangs.
+///
+/// The events go to a fixed-size ring buffer, without locking or
+/// allocating, so that the recorder can stay on all the time. It is
+/// written out from the signal handler, with async-signal-safe
+/// functions only.
+class FlightRecorder {
+public:
+  /// The kinds of events
+  enum Type {
+    /// A read is about to be done
+    Request,
+    /// Sectors were read
+    Read,
+    /// Sectors could not be read
+    Error,
+    /// Sectors were read again during the second pass, with success
+    /// or not
+    Recovered,
+    Retry,
+    /// The second pass gives up on sectors
+    GivenUp,
+    /// A file is started
+    File,
+    /// A pass starts or ends
+    PhaseStart,
+    PhaseEnd
+  };
+
+  /// Records an event. @a file can be NULL, and @a text, if not NULL,
+  /// is truncated to a few characters. The @a latency is in seconds.
+  static void record(Type type, const DVDFileData * file, 
+                     int sector = 0, int count = 0, 
+                     double latency = 0, const char * text = NULL);
+
+  /// Writes the events to @a file from now on, rather than to the
+  /// default file (see setDefaultFile()).
+  static void setFile(const std::string & file);
+
+  /// Where to write the events if no file was given with setFile(),
+  /// typically next to the target of the copy. Before it is called,
+  /// they go to dvdcopy-PID.flight in the current directory.
+  static void setDefaultFile(const std::string & file);
+
+  /// Installs the signal handlers, and the alternate stack they run
+  /// on for the calling thread.
+  static void install();
+
+  /// Installs the alternate stack of the signal handlers for the
+  /// calling thread, which each thread must do when it starts, since
+  /// they have their own.
+  static void threadStarted();
+
+  /// Writes the events to the file, oldest first. @a sig is the
+  /// signal that caused it, if any.
+  static void dump(int sig = 0);
+};
+
+#endif
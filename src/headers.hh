@@ -31,6 +31,15 @@
 #include <memory>
 #include <functional>
 #include <set>
+#include <deque>
+#include <list>
+
+// Threads
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
 
 // DVDRead
 #include <dvdread/dvd_reader.h>
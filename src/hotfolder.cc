@@ -0,0 +1,267 @@
+/**
+    \file hotfolder.cc
+    Implementation of the HotFolder class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "hotfolder.hh"
+#include "dvdcopy.hh"
+#include "jobrecord.hh"
+#include "trace.hh"
+#include "flightrecorder.hh"
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+
+/// The names of the modes
+static const char * modeNames[] = { "copy", "scan", "verify" };
+
+HotFolder::HotFolder(const std::string & in, const std::string & out,
+                     Mode m, const DVDCopy & opts) :
+  incoming(in), output(out), mode(m), options(opts), running(0),
+  maxJobs(2)
+{
+  if(pipe(wakeup)) {
+    std::string err = "Could not create a pipe: ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  fcntl(wakeup[0], F_SETFL, O_NONBLOCK);
+}
+
+HotFolder::~HotFolder()
+{
+  // Wait for the jobs still running
+  std::unique_lock<std::mutex> lock(mutex);
+  while(running > 0) {
+    lock.unlock();
+    struct pollfd pfd = { wakeup[0], POLLIN, 0 };
+    poll(&pfd, 1, 1000);
+    char buf[64];
+    while(read(wakeup[0], buf, sizeof(buf)) > 0)
+      ;
+    lock.lock();
+  }
+  close(wakeup[0]);
+  close(wakeup[1]);
+}
+
+HotFolder::Mode HotFolder::parseMode(const std::string & str)
+{
+  if(str == "copy")
+    return Copy;
+  if(str == "scan")
+    return Scan;
+  if(str == "verify")
+    return Verify;
+  throw std::runtime_error("Unknown batch mode: '" + str + 
+                           "', should be copy, scan or verify");
+}
+
+std::string HotFolder::baseName(const std::string & name)
+{
+  size_t idx = name.rfind('.');
+  return name.substr(0, idx);
+}
+
+void HotFolder::enqueue(const std::string & name)
+{
+  size_t idx = name.rfind('.');
+  if(idx == std::string::npos || name[0] == '.')
+    return;
+  std::string ext = name.substr(idx + 1);
+  for(char & c : ext)
+    c = tolower(c);
+  if(ext != "iso" && ext != "img")
+    return;
+
+  std::string path = incoming + "/" + name;
+  struct stat st;
+  if(stat(path.c_str(), &st) || ! S_ISREG(st.st_mode))
+    return;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if(known.count(name))
+    return;
+  known.insert(name);
+  // Failed images are processed again
+  JobRecord record;
+  if(record.read(output + "/" + baseName(name) + ".result") &&
+     record.get("status") == "success") {
+    printf("Skipping %s, already processed\n", name.c_str());
+    return;
+  }
+  printf("Queuing %s (%lld MB)\n", name.c_str(), 
+         (long long) st.st_size >> 20);
+  queued.insert(std::make_pair((long long) st.st_size, name));
+}
+
+void HotFolder::dispatch()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  while(running < maxJobs && ! queued.empty()) {
+    auto first = queued.begin();
+    std::string name = first->second;
+    long long size = first->first;
+    queued.erase(first);
+    ++running;
+    std::thread(&HotFolder::runJob, this, name, size).detach();
+  }
+}
+
+void HotFolder::runJob(const std::string & name, long long size)
+{
+  std::string image = incoming + "/" + name;
+  std::string target = output + "/" + baseName(name);
+  Trace::nameThread("job " + name);
+  FlightRecorder::threadStarted();
+
+  struct timeval before, after;
+  gettimeofday(&before, NULL);
+  printf("Starting to %s %s\n", modeNames[mode], name.c_str());
+  fflush(stdout);
+
+  std::string error;
+  const char * countName = "";
+  int count = 0;
+  try {
+    DVDCopy dvd;
+    dvd.copyOptions(options);
+    // All the images count as one source in the metrics
+    dvd.metricsName = incoming;
+    switch(mode) {
+    case Copy:
+      countName = "skipped";
+      count = dvd.copy(image.c_str(), target.c_str());
+      if(count > 0)
+        dvd.secondPass(image.c_str(), target.c_str());
+      break;
+    case Scan:
+      countName = "bad-sectors";
+      count = dvd.scanForBadSectors(image.c_str(), 
+                                    (target + ".bad").c_str());
+      break;
+    case Verify:
+      countName = "differing";
+      count = dvd.verify(image.c_str(), target.c_str());
+      break;
+    }
+  }
+  catch(const std::exception & e) {
+    error = e.what();
+  }
+  gettimeofday(&after, NULL);
+  double duration = (after.tv_sec - before.tv_sec)*1.0 + 
+    1e-6 * (after.tv_usec - before.tv_usec);
+
+  JobRecord record;
+  record.set("image", image);
+  record.set("mode", modeNames[mode]);
+  record.set("size", size);
+  record.set("started", (long long) before.tv_sec);
+  record.set("duration", duration);
+  if(error.empty()) {
+    record.set("status", "success");
+    record.set(countName, (long long) count);
+  }
+  else {
+    record.set("status", "failed");
+    record.set("error", error);
+  }
+  try {
+    record.write(target + ".result");
+  }
+  catch(const std::exception & e) {
+    fprintf(stderr, "%s\n", e.what());
+  }
+  printf("\nDone with %s (%s): %s\n", name.c_str(), modeNames[mode],
+         error.empty() ? "success" : error.c_str());
+  fflush(stdout);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  --running;
+  write(wakeup[1], "", 1);
+}
+
+void HotFolder::run()
+{
+  struct stat st;
+  if(stat(output.c_str(), &st)) {
+    fprintf(stderr,"Creating directory %s\n", output.c_str());
+    mkdir(output.c_str(), 0755);
+  }
+
+  int fd = inotify_init1(IN_CLOEXEC);
+  if(fd < 0 || inotify_add_watch(fd, incoming.c_str(), 
+                                 IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    std::string err = "Could not watch '" + incoming + "': " + 
+      strerror(errno);
+    if(fd >= 0)
+      close(fd);
+    throw std::runtime_error(err);
+  }
+
+  // The images that are already there, which is done after setting
+  // up the watch so that none is missed.
+  DIR * d = opendir(incoming.c_str());
+  if(d) {
+    struct dirent * ent;
+    while((ent = readdir(d)))
+      enqueue(ent->d_name);
+    closedir(d);
+  }
+  printf("Watching %s for images to %s, %d at a time\n", incoming.c_str(),
+         modeNames[mode], maxJobs);
+  fflush(stdout);
+
+  char buffer[sizeof(struct inotify_event) + NAME_MAX + 1]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  while(true) {
+    dispatch();
+    struct pollfd fds[2] = { { fd, POLLIN, 0 }, { wakeup[0], POLLIN, 0 } };
+    if(poll(fds, 2, -1) < 0) {
+      if(errno == EINTR)
+        continue;
+      close(fd);
+      throw std::runtime_error(std::string("Error while watching: ") + 
+                               strerror(errno));
+    }
+    if(fds[1].revents) {
+      char buf[64];
+      while(read(wakeup[0], buf, sizeof(buf)) > 0)
+        ;
+    }
+    if(fds[0].revents) {
+      ssize_t len = read(fd, buffer, sizeof(buffer));
+      for(ssize_t i = 0; i < len; ) {
+        struct inotify_event * event = 
+          reinterpret_cast<struct inotify_event *>(buffer + i);
+        if(event->len > 0)
+          enqueue(event->name);
+        i += sizeof(struct inotify_event) + event->len;
+      }
+    }
+  }
+}
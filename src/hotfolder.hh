@@ -0,0 +1,107 @@
+/**
+    \file hotfolder.hh
+    Batch processing of the images dropped in a directory
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __HOTFOLDER_H
+#define __HOTFOLDER_H
+
+class DVDCopy;
+
+/// Watches a directory, and processes each image (.iso or .img file)
+/// that appears in it: it is copied, scanned or verified against its
+/// copy, in the output directory.
+///
+/// At most maxJobs images are processed at the same time, the
+/// smallest first. Each job writes a result record next to its
+/// output, as the image name followed by .result. Images that
+/// already have a successful result record are not processed again,
+/// so that the watch can be stopped and restarted at will.
+class HotFolder {
+public:
+  /// What is done with the images
+  enum Mode {
+    /// Copies the image to a directory named after it (followed by a
+    /// second pass if necessary)
+    Copy,
+    /// Scans it for bad sectors, into a bad sectors file named after
+    /// it
+    Scan,
+    /// Compares it with the copy in the directory named after it
+    Verify
+  };
+
+protected:
+  /// The watched directory
+  std::string incoming;
+
+  /// Where the results go
+  std::string output;
+
+  Mode mode;
+
+  /// The options of the jobs (see DVDCopy::copyOptions())
+  const DVDCopy & options;
+
+  /// Protects what follows
+  std::mutex mutex;
+
+  /// The images waiting to be processed, by size
+  std::multimap<long long, std::string> queued;
+
+  /// The images already queued or processed
+  std::set<std::string> known;
+
+  /// The number of jobs running
+  int running;
+
+  /// A pipe used by the jobs to wake up the main loop when they are
+  /// done
+  int wakeup[2];
+
+  /// Queues the given file of the incoming directory if it is an
+  /// image that has not been processed yet.
+  void enqueue(const std::string & name);
+
+  /// Starts as many jobs as possible.
+  void dispatch();
+
+  /// Processes the given image, and writes its result record.
+  void runJob(const std::string & name, long long size);
+
+  /// The name of the image without its extension
+  static std::string baseName(const std::string & name);
+
+public:
+
+  /// The maximum number of jobs running at the same time
+  int maxJobs;
+
+  HotFolder(const std::string & incoming, const std::string & output,
+            Mode mode, const DVDCopy & options);
+
+  /// Parses a mode: copy, scan or verify.
+  static Mode parseMode(const std::string & str);
+
+  /// Processes the images present in the directory, and then the
+  /// ones that appear there, forever.
+  void run();
+
+  ~HotFolder();
+};
+
+#endif
@@ -0,0 +1,86 @@
+/**
+    \file jobrecord.cc
+    Implementation of the JobRecord class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "jobrecord.hh"
+
+#include <stdio.h>
+
+void JobRecord::set(const std::string & key, const std::string & value)
+{
+  for(auto & field : fields) {
+    if(field.first == key) {
+      field.second = value;
+      return;
+    }
+  }
+  fields.push_back(std::make_pair(key, value));
+}
+
+void JobRecord::set(const std::string & key, long long value)
+{
+  set(key, std::to_string(value));
+}
+
+void JobRecord::set(const std::string & key, double value)
+{
+  char buffer[40];
+  snprintf(buffer, sizeof(buffer), "%.1f", value);
+  set(key, std::string(buffer));
+}
+
+std::string JobRecord::get(const std::string & key) const
+{
+  for(const auto & field : fields)
+    if(field.first == key)
+      return field.second;
+  return std::string();
+}
+
+void JobRecord::write(const std::string & file) const
+{
+  std::string tmp = file + ".tmp";
+  FILE * out = fopen(tmp.c_str(), "w");
+  if(! out) {
+    std::string err = "Could not write '" + tmp + "': " + strerror(errno);
+    throw std::runtime_error(err);
+  }
+  for(const auto & field : fields)
+    fprintf(out, "%s: %s\n", field.first.c_str(), field.second.c_str());
+  fclose(out);
+  rename(tmp.c_str(), file.c_str());
+}
+
+bool JobRecord::read(const std::string & file)
+{
+  FILE * in = fopen(file.c_str(), "r");
+  if(! in)
+    return false;
+  char buffer[1024];
+  while(fgets(buffer, sizeof(buffer), in)) {
+    std::string line(buffer);
+    if(! line.empty() && line[line.size() - 1] == '\n')
+      line.erase(line.size() - 1);
+    size_t idx = line.find(": ");
+    if(idx != std::string::npos)
+      set(line.substr(0, idx), line.substr(idx + 2));
+  }
+  fclose(in);
+  return true;
+}
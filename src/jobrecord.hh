@@ -0,0 +1,49 @@
+/**
+    \file jobrecord.hh
+    Records of the jobs run in batch
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __JOBRECORD_H
+#define __JOBRECORD_H
+
+/// A small record made of "key: value" lines, describing the outcome
+/// of a job or the state of a drive, to be read by other programs.
+class JobRecord {
+  /// The keys and values, in order
+  std::vector<std::pair<std::string, std::string> > fields;
+
+public:
+  /// Sets the given field, keeping the position of the ones already
+  /// set.
+  void set(const std::string & key, const std::string & value);
+  void set(const std::string & key, long long value);
+  void set(const std::string & key, double value);
+
+  /// Returns the value of the given field, or an empty string if it
+  /// is not set.
+  std::string get(const std::string & key) const;
+
+  /// Writes the record to the given file. The file is replaced
+  /// atomically, so that readers never see a partial record.
+  void write(const std::string & file) const;
+
+  /// Reads the record from the given file, as written by
+  /// write(). Returns false if the file could not be read.
+  bool read(const std::string & file);
+};
+
+#endif
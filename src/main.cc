@@ -25,13 +25,31 @@
 #include "headers.hh"
 #include "dvdcopy.hh"
 #include "dvdreader.hh"
+#include "copymerger.hh"
+#include "sectorbuffer.hh"
+#include "hotfolder.hh"
+#include "drivefleet.hh"
+#include "ratelimiter.hh"
+#include "dvdoutfile.hh"
+#include "eventlog.hh"
+#include "metrics.hh"
+#include "stats.hh"
+#include "trace.hh"
+#include "flightrecorder.hh"
 
 #include <getopt.h>
+#include <unistd.h>
 
 void printHelp(const char * progname)
 {
   std::cout << "Usage: " << progname 
-            << " source target\n\n" 
+            << " source target\n" 
+            << "       " << progname 
+            << " --merge target copy1 copy2...\n"
+            << "       " << progname 
+            << " --hot-folder MODE incoming output\n"
+            << "       " << progname 
+            << " --fleet output drive1 drive2...\n\n" 
             << "Copies the DVD at the device source to the directory target\n\n"
             << "Options: \n" 
             << " -h, --help: print this help message\n"
@@ -39,13 +57,76 @@ void printHelp(const char * progname)
             << " -n, --number NB:  read NB sectors at a time\n"
             << " -s, --second-pass: run a second pass reading only bad sectors\n"
             << " -b, --bad-sectors: specify an alternate bad sectors file\n" 
+            << " -j, --jobs NB: copy NB files at a time from images and\n"
+            << "     directories, or merge NB files at a time\n"
             << " -B, --backwards: make the second pass backwards\n" 
+            << " --max-attempts NB: in the second pass, give up on sectors\n"
+            << "     that already failed NB times\n" 
+            << " --interleave NB: in the second pass, read only one ECC block\n"
+            << "     out of NB in each sweep\n" 
+            << " --retries NB: in the second pass, retry failed sectors NB times\n"
+            << " --bust-distance NB: read NB sectors away before some retries\n"
+            << "     (0 to disable)\n"
+            << " --bust-size NB: the number of sectors read away\n"
+            << " --simulate-drive SPEC: simulate errors on top of the source\n" 
+            << " --additional-source DEV: in the second pass, also read from\n"
+            << "     another copy of the disc in DEV (can be repeated)\n"
+            << " --merge: merge copies of the same disc, taking each sector\n"
+            << "     from a copy in which it is not bad\n"
+            << " --huge-pages: use huge pages for large read buffers\n"
+            << " --mmap-output: read directly into the mapped output files\n"
+            << " --no-direct-access: always read through libdvdread\n"
+            << " --queue-depth NB: keep NB reads in flight when reading\n"
+            << "     directories and images directly (needs io_uring)\n"
+            << " --verify: compare the copy in target with the source\n"
+            << " --hot-folder MODE: copy, scan or verify each image that\n"
+            << "     appears in the incoming directory, into output\n"
+            << " --fleet: copy the discs inserted in the drives (or the images\n"
+            << "     and copies put in spool directories), forever\n"
+            << " --max-jobs NB: process NB images at a time with --hot-folder,\n"
+            << "     or let NB drives run their first pass at a time with --fleet\n"
+            << " --max-output-rate MB: write at most MB megabytes per second\n"
+            << "     (or as fast as the drives read, if they read faster)\n"
+            << " --io-priority CLASS[:LEVEL]: the I/O priority, idle,\n"
+            << "     best-effort or realtime, with a level from 0 to 7\n"
+            << " --refresh-rate NB: show the progress at most NB times\n"
+            << "     per second (0 to show it only at the end)\n"
+            << " --progress-fd FD: write events (files, reads, errors,\n"
+            << "     retries, progress) as JSON lines to the descriptor FD\n"
+            << " --events FORMAT: the format of the events (only json); without\n"
+            << "     --progress-fd, they go to the standard output, and the\n"
+            << "     messages to the standard error\n"
+            << " --metrics FILE: write metrics about the drives and the output\n"
+            << "     to FILE every few seconds, in the Prometheus text format\n"
+            << " --stats: show how long the reads, writes and bookkeeping took\n"
+            << "     at the end (needs configure --enable-stats)\n"
+            << " --surface-map: record the latency and errors of the reads\n"
+            << "     along the disc, next to the bad sectors file (see dvdmap)\n"
+            << " --trace FILE: write a trace of the reads, writes and retries\n"
+            << "     to FILE, in the Chrome trace format (see Perfetto)\n"
+            << " --record-session LOG: record all the reads of the source in LOG\n"
+            << " --replay-session LOG: replay the reads recorded in LOG on top\n"
+            << "     of the source (a copy of the same disc)\n"
+            << " --replay-speed X: replay the reads X times faster than\n"
+            << "     recorded (by default, at once)\n"
+            << " --validate-packs: read and check all the VOB sectors of\n"
+            << "     directories and images, rather than copying them directly\n"
+            << " --flight-recorder FILE: where to write the last events when\n"
+            << "     killed, crashing or on SIGUSR1 (by default, next to target)\n"
             << " -S, --scan: scan directory for bad sectors\n" 
             << " -I, --ifo-scan: scan ifo files for info\n" 
             << " -e, --eject: attempts to eject the source after copying\n";
     
 }
 
+#ifdef WITH_STATS
+/// Shows the timers, at exit
+static void printStats()
+{
+  Stats::report(stderr);
+}
+#endif
+
 static struct option long_options[] = {
   { "help", 0, NULL, 'h'},
   { "eject", 0, NULL, 'e' },
@@ -53,11 +134,42 @@ static struct option long_options[] = {
   { "number", 1, NULL, 'n' },
   { "second-pass", 0, NULL, 's' },
   { "bad-sectors", 1, NULL, 'b' },
+  { "jobs", 1, NULL, 'j' },
   { "backwards", 0, NULL, 'B' },
   { "scan", 0, NULL, 'S' },
   { "ifo-scan", 0, NULL, 'I' },
   { "splice-ifos", 0, NULL, 10 },
   { "splice-ifos-base", 1, NULL, 11 },
+  { "max-attempts", 1, NULL, 12 },
+  { "interleave", 1, NULL, 13 },
+  { "retries", 1, NULL, 14 },
+  { "bust-distance", 1, NULL, 15 },
+  { "bust-size", 1, NULL, 16 },
+  { "simulate-drive", 1, NULL, 17 },
+  { "additional-source", 1, NULL, 18 },
+  { "merge", 0, NULL, 19 },
+  { "huge-pages", 0, NULL, 20 },
+  { "mmap-output", 0, NULL, 21 },
+  { "no-direct-access", 0, NULL, 22 },
+  { "queue-depth", 1, NULL, 23 },
+  { "hot-folder", 1, NULL, 24 },
+  { "max-jobs", 1, NULL, 25 },
+  { "max-output-rate", 1, NULL, 26 },
+  { "verify", 0, NULL, 27 },
+  { "fleet", 0, NULL, 28 },
+  { "io-priority", 1, NULL, 29 },
+  { "refresh-rate", 1, NULL, 30 },
+  { "progress-fd", 1, NULL, 31 },
+  { "events", 1, NULL, 32 },
+  { "metrics", 1, NULL, 33 },
+  { "stats", 0, NULL, 34 },
+  { "surface-map", 0, NULL, 35 },
+  { "trace", 1, NULL, 36 },
+  { "record-session", 1, NULL, 37 },
+  { "replay-session", 1, NULL, 38 },
+  { "replay-speed", 1, NULL, 39 },
+  { "flight-recorder", 1, NULL, 40 },
+  { "validate-packs", 0, NULL, 41 },
   { NULL, 0, NULL, 0}
 };
 
@@ -71,9 +183,18 @@ int main(int argc, char ** argv)
   int ifoScan = 0;
   int eject = 0;
   int spliceIFOs = 0;
+  int merge = 0;
+  int verify = 0;
+  const char * hotFolder = NULL;
+  int maxJobs = 2;
+  int fleet = 0;
+  int progressFD = -1;
+  const char * eventFormat = NULL;
+
+  FlightRecorder::install();
 
   do {
-    option = getopt_long(argc, argv, "b:BheIl:sSn:",
+    option = getopt_long(argc, argv, "b:BheIj:l:sSn:",
                          long_options, NULL);
     
     switch(option) {
@@ -84,6 +205,102 @@ int main(int argc, char ** argv)
     case 11:
       spliceIFOs = atoi(optarg);
       break;
+    case 12:
+      dvd.maxAttempts = atoi(optarg);
+      break;
+    case 13:
+      dvd.interleave = atoi(optarg);
+      break;
+    case 14:
+      dvd.retries = atoi(optarg);
+      break;
+    case 15:
+      dvd.retryStrategy.distance = atoi(optarg);
+      break;
+    case 16:
+      dvd.retryStrategy.size = atoi(optarg);
+      break;
+    case 17:
+      dvd.simulateDrive(optarg);
+      break;
+    case 18:
+      dvd.addSource(optarg);
+      break;
+    case 19:
+      merge = 1;
+      break;
+    case 20:
+      SectorArena::global().hugePages = true;
+      break;
+    case 21:
+      dvd.mapOutput = true;
+      break;
+    case 22:
+      dvd.directAccess = false;
+      break;
+    case 23:
+      dvd.queueDepth = atoi(optarg);
+      break;
+    case 24:
+      hotFolder = optarg;
+      break;
+    case 25:
+      maxJobs = atoi(optarg);
+      break;
+    case 26:
+      DVDOutFile::rateLimiter = new RateLimiter(atof(optarg) * 1e6);
+      break;
+    case 27:
+      verify = 1;
+      break;
+    case 28:
+      fleet = 1;
+      break;
+    case 29:
+      DVDOutFile::setIOPriority(optarg);
+      break;
+    case 30:
+      Progress::refreshRate = atof(optarg);
+      break;
+    case 31:
+      progressFD = atoi(optarg);
+      break;
+    case 32:
+      eventFormat = optarg;
+      break;
+    case 33:
+      Metrics::open(optarg);
+      break;
+    case 34:
+#ifdef WITH_STATS
+      Stats::enabled = true;
+      atexit(printStats);
+#else
+      throw std::runtime_error("The timers are not compiled in, "
+                               "configure with --enable-stats");
+#endif
+      break;
+    case 35:
+      dvd.recordSurface = true;
+      break;
+    case 36:
+      Trace::open(optarg);
+      break;
+    case 37:
+      dvd.recordSession(optarg);
+      break;
+    case 38:
+      dvd.replaySession(optarg);
+      break;
+    case 39:
+      dvd.replaySpeed = atof(optarg);
+      break;
+    case 40:
+      FlightRecorder::setFile(optarg);
+      break;
+    case 41:
+      dvd.validatePacks = true;
+      break;
     case 'h': 
       printHelp(argv[0]);
       return 0;
@@ -96,6 +313,9 @@ int main(int argc, char ** argv)
     case 'B': 
       dvd.backwards = true;
       break;
+    case 'j':
+      dvd.jobs = atoi(optarg);
+      break;
     case 'n':  {
       int nb = atoi(optarg);
       if(nb > 0)
@@ -119,6 +339,58 @@ int main(int argc, char ** argv)
       break;
     }
   } while(option != -1);
+
+  if(progressFD >= 0 || eventFormat) {
+    if(progressFD < 0) {
+      // The events take over the standard output
+      fflush(stdout);
+      progressFD = dup(1);
+      dup2(2, 1);
+    }
+    EventLog::open(progressFD, eventFormat ? eventFormat : "json");
+  }
+
+  if(fleet) {
+    if(argc < optind + 2) {
+      printHelp(argv[0]);
+      return 1;
+    }
+    DriveFleet drives(argv[optind], dvd);
+    drives.maxWriters = maxJobs;
+    for(int i = optind + 1; i < argc; i++)
+      drives.addSource(argv[i]);
+    drives.run();
+    return 0;
+  }
+
+  if(hotFolder) {
+    if(argc < optind + 2) {
+      printHelp(argv[0]);
+      return 1;
+    }
+    HotFolder folder(argv[optind], argv[optind+1], 
+                     HotFolder::parseMode(hotFolder), dvd);
+    folder.maxJobs = maxJobs;
+    folder.run();
+    return 0;
+  }
+
+  if(merge) {
+    if(argc < optind + 2) {
+      printHelp(argv[0]);
+      return 1;
+    }
+    CopyMerger merger(argv[optind]);
+    for(int i = optind + 1; i < argc; i++)
+      merger.addCopy(argv[i]);
+    int bad = merger.merge(dvd.jobs);
+    if(bad > 0) {
+      printf("%d sectors are bad in all the copies\n", bad);
+      return 1;
+    }
+    return 0;
+  }
+
   if(argc != optind + (ifoScan ? 1 : 2)) {
     printHelp(argv[0]);
     return 1;
@@ -128,6 +400,13 @@ int main(int argc, char ** argv)
     dvd.secondPass(argv[optind], argv[optind+1]);
   else if(scan)
     dvd.scanForBadSectors(argv[optind], argv[optind+1]);
+  else if(verify) {
+    int differ = dvd.verify(argv[optind], argv[optind+1]);
+    if(differ > 0) {
+      printf("%d sectors differ\n", differ);
+      return 1;
+    }
+  }
   else if(ifoScan)
     dvd.scanIFOs(argv[optind]);
   else if(spliceIFOs > 0)
@@ -0,0 +1,204 @@
+/**
+    \file metrics.cc
+    Implementation of the Metrics class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "headers.hh"
+#include "metrics.hh"
+#include "flightrecorder.hh"
+
+#include <stdio.h>
+#include <math.h>
+
+Metrics * Metrics::metrics = NULL;
+
+const double Metrics::Histogram::bounds[10] = {
+  0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30
+};
+
+Metrics::Histogram::Histogram() : sum(0)
+{
+  for(std::atomic<long long> & b : buckets)
+    b = 0;
+}
+
+void Metrics::Histogram::observe(double value)
+{
+  int i = 0;
+  while(i < 10 && value > bounds[i])
+    ++i;
+  ++buckets[i];
+  double s = sum;
+  while(! sum.compare_exchange_weak(s, s + value))
+    ;
+}
+
+void Metrics::Histogram::write(FILE * out, const char * name, 
+                               const std::string & labels) const
+{
+  std::string l = labels.empty() ? "" : labels + ",";
+  long long total = 0;
+  for(int i = 0; i < 10; i++) {
+    total += buckets[i];
+    fprintf(out, "%s_bucket{%sle=\"%g\"} %lld\n", name, l.c_str(),
+            bounds[i], total);
+  }
+  total += buckets[10];
+  fprintf(out, "%s_bucket{%sle=\"+Inf\"} %lld\n", name, l.c_str(), total);
+  std::string b = labels.empty() ? "" : "{" + labels + "}";
+  fprintf(out, "%s_sum%s %g\n", name, b.c_str(), (double) sum);
+  fprintf(out, "%s_count%s %lld\n", name, b.c_str(), total);
+}
+
+Metrics::Drive::Drive() : read(0), skipped(0), retried(0), recovered(0),
+                          phase("idle")
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+
+Metrics::Metrics(const std::string & f) : file(f), bytesWritten(0)
+{
+}
+
+void Metrics::open(const std::string & file, double period)
+{
+  metrics = new Metrics(file);
+  writeOut();
+  std::thread([period]() {
+      FlightRecorder::threadStarted();
+      while(true) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(period));
+        writeOut();
+      }
+    }).detach();
+}
+
+Metrics::Drive & Metrics::drive(const std::string & device)
+{
+  std::lock_guard<std::mutex> lock(metrics->mutex);
+  std::unique_ptr<Drive> & d = metrics->drives[device];
+  if(! d)
+    d.reset(new Drive);
+  return *d;
+}
+
+void Metrics::setPhase(const std::string & device, const std::string & phase)
+{
+  if(! metrics)
+    return;
+  Drive & d = drive(device);
+  std::lock_guard<std::mutex> lock(metrics->mutex);
+  d.phase = phase;
+  metrics->write();
+}
+
+void Metrics::written(size_t bytes, double seconds)
+{
+  metrics->bytesWritten += bytes;
+  metrics->writeLatency.observe(seconds);
+}
+
+void Metrics::writeOut()
+{
+  if(! metrics)
+    return;
+  std::lock_guard<std::mutex> lock(metrics->mutex);
+  metrics->write();
+}
+
+/// Returns the label for the given device, with the characters
+/// escaped as needed.
+static std::string deviceLabel(const std::string & device)
+{
+  std::string label = "device=\"";
+  for(char c : device) {
+    if(c == '\\' || c == '"')
+      label += '\\';
+    if(c == '\n')
+      label += "\\n";
+    else
+      label += c;
+  }
+  return label + "\"";
+}
+
+/// Writes the header of a metric
+static void writeHeader(FILE * out, const char * name, const char * type,
+                        const char * help)
+{
+  fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void Metrics::write()
+{
+  static const char * phases[] = {
+    "idle", "copy", "scan", "second-pass", "verify", NULL
+  };
+  std::string tmp = file + ".tmp";
+  FILE * out = fopen(tmp.c_str(), "w");
+  if(! out) {
+    fprintf(stderr, "Could not write '%s': %s\n", tmp.c_str(), 
+            strerror(errno));
+    return;
+  }
+
+  struct Counter {
+    const char * name;
+    const char * help;
+    std::atomic<long long> Drive::* value;
+  };
+  static const Counter counters[] = {
+    { "dvdcopy_sectors_read_total", "Sectors read fine", &Drive::read },
+    { "dvdcopy_sectors_skipped_total", "Sectors that could not be read",
+      &Drive::skipped },
+    { "dvdcopy_sectors_retried_total", "Sectors read again in a second pass",
+      &Drive::retried },
+    { "dvdcopy_sectors_recovered_total", 
+      "Sectors recovered in a second pass", &Drive::recovered },
+  };
+  for(const Counter & c : counters) {
+    writeHeader(out, c.name, "counter", c.help);
+    for(const auto & d : drives)
+      fprintf(out, "%s{%s} %lld\n", c.name, deviceLabel(d.first).c_str(),
+              (long long) ((*d.second).*c.value));
+  }
+
+  writeHeader(out, "dvdcopy_read_latency_seconds", "histogram",
+              "Duration of the reads");
+  for(const auto & d : drives)
+    d.second->readLatency.write(out, "dvdcopy_read_latency_seconds",
+                                deviceLabel(d.first));
+
+  writeHeader(out, "dvdcopy_phase", "gauge", 
+              "What the drive is doing (1 for the current phase)");
+  for(const auto & d : drives)
+    for(const char ** p = phases; *p; p++)
+      fprintf(out, "dvdcopy_phase{%s,phase=\"%s\"} %d\n", 
+              deviceLabel(d.first).c_str(), *p, d.second->phase == *p);
+
+  writeHeader(out, "dvdcopy_bytes_written_total", "counter",
+              "Bytes written to the output files");
+  fprintf(out, "dvdcopy_bytes_written_total %lld\n", 
+          (long long) bytesWritten);
+  writeHeader(out, "dvdcopy_write_latency_seconds", "histogram",
+              "Duration of the writes to the output files");
+  writeLatency.write(out, "dvdcopy_write_latency_seconds", "");
+  fclose(out);
+  rename(tmp.c_str(), file.c_str());
+}
@@ -0,0 +1,128 @@
+/**
+    \file metrics.hh
+    Metrics in the Prometheus text format
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __METRICS_H
+#define __METRICS_H
+
+/// Counters and histograms about the drives and the output, written
+/// in the Prometheus text format to a file that is rewritten
+/// periodically (for the textfile collector of node_exporter, or for
+/// anything that can read it).
+///
+/// The metrics are only kept once open() has been called; the code
+/// updating them should check enabled() first. The counters are
+/// atomic, so that they can be updated from the reading threads
+/// without locking.
+class Metrics {
+public:
+
+  /// A histogram of durations, in seconds, with fixed buckets
+  class Histogram {
+    /// The number of observations in each bucket (not cumulated),
+    /// the last one being for the ones above all the bounds
+    std::atomic<long long> buckets[11];
+
+    /// The sum of the observations
+    std::atomic<double> sum;
+
+  public:
+    /// The upper bounds of the buckets
+    static const double bounds[10];
+
+    Histogram();
+
+    /// Adds an observation
+    void observe(double value);
+
+    /// Writes the histogram with the given name and labels.
+    void write(FILE * out, const char * name, 
+               const std::string & labels) const;
+  };
+
+  /// The metrics of a drive (or of any other source)
+  class Drive {
+  public:
+    /// Sectors read fine, during the copy or the scan
+    std::atomic<long long> read;
+
+    /// Sectors that could not be read during the copy or the scan
+    std::atomic<long long> skipped;
+
+    /// Sectors read again during the second pass, and the ones that
+    /// were recovered then
+    std::atomic<long long> retried;
+    std::atomic<long long> recovered;
+
+    /// The duration of the reads
+    Histogram readLatency;
+
+    /// What the drive is doing (copy, scan, second-pass, verify or
+    /// idle)
+    std::string phase;
+
+    Drive();
+  };
+
+  /// Returns the metrics of the given drive, creating them if needed.
+  static Drive & drive(const std::string & device);
+
+  /// Tells what the drive is doing, and writes the metrics out.
+  static void setPhase(const std::string & device, 
+                       const std::string & phase);
+
+  /// Accounts for @a bytes written in @a seconds.
+  static void written(size_t bytes, double seconds);
+
+  /// Whether the metrics are kept
+  static bool enabled() {
+    return metrics != NULL;
+  };
+
+  /// Starts keeping the metrics, and writing them to @a file every
+  /// @a period seconds (and when the phase of a drive changes).
+  static void open(const std::string & file, double period = 5);
+
+  /// Writes the metrics to the file now.
+  static void writeOut();
+
+private:
+  /// Where the metrics go
+  std::string file;
+
+  /// Protects drives and the phases, and the writing of the file
+  std::mutex mutex;
+
+  std::map<std::string, std::unique_ptr<Drive> > drives;
+
+  /// The bytes written to the output files, and the duration of the
+  /// writes
+  std::atomic<long long> bytesWritten;
+  Histogram writeLatency;
+
+  Metrics(const std::string & file);
+
+  /// Writes the metrics. The mutex must be held.
+  void write();
+
+  /// The metrics, or NULL
+  static Metrics * metrics;
+};
+
+#endif
@@ -0,0 +1,184 @@
+/**
+    \file pipeline.hh
+    Stages processing the sectors read by DVDFile::walkFile()
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __PIPELINE_H
+#define __PIPELINE_H
+
+#include "badsectors.hh"
+#include "dvdoutfile.hh"
+
+class DVDFileData;
+
+/// The sectors read by DVDFile::walkFile() go through a pipeline of
+/// stages, whose order and types are known at compile time, so that
+/// all the calls can be inlined.
+///
+/// A stage is a class with the following template functions. The
+/// first two get whole chunks of sectors, and pass them on (or not)
+/// to the @a next stage:
+///
+/// @code
+/// template<class Next>
+/// void sectorsRead(int offset, int nb, unsigned char * buffer,
+///                  const DVDFileData * dat, Next & next);
+///
+/// template<class Next>
+/// void sectorsFailed(int offset, int nb, ReadAttempt::Outcome outcome,
+///                    const DVDFileData * dat, Next & next);
+///
+/// template<class Next>
+/// unsigned char * readBuffer(int offset, int nb, Next & next);
+/// @endcode
+///
+/// The last one can return where the @a nb sectors at @a offset
+/// should be read, to avoid copying them afterwards (or NULL to let
+/// the next stages decide, or to use the buffer of walkFile()).
+///
+/// Stages are combined using makePipeline(); the stages are kept by
+/// reference.
+template<class... Stages> class Pipeline;
+
+/// The end of a pipeline
+template<> class Pipeline<> {
+public:
+  void sectorsRead(int, int, unsigned char *, const DVDFileData *) {;};
+
+  void sectorsFailed(int, int, ReadAttempt::Outcome,
+                     const DVDFileData *) {;};
+
+  unsigned char * readBuffer(int, int) {
+    return NULL;
+  };
+};
+
+template<class First, class... Rest>
+class Pipeline<First, Rest...> {
+  First & first;
+  Pipeline<Rest...> rest;
+public:
+  Pipeline(First & f, Rest & ... r) : first(f), rest(r...) {;};
+
+  void sectorsRead(int offset, int nb, unsigned char * buffer,
+                   const DVDFileData * dat) {
+    first.sectorsRead(offset, nb, buffer, dat, rest);
+  };
+
+  void sectorsFailed(int offset, int nb, ReadAttempt::Outcome outcome,
+                     const DVDFileData * dat) {
+    first.sectorsFailed(offset, nb, outcome, dat, rest);
+  };
+
+  unsigned char * readBuffer(int offset, int nb) {
+    return first.readBuffer(offset, nb, rest);
+  };
+};
+
+/// Builds a pipeline from the given stages, in the order in which
+/// they process the sectors.
+template<class... Stages>
+Pipeline<Stages...> makePipeline(Stages & ... stages)
+{
+  return Pipeline<Stages...>(stages...);
+}
+
+
+/// Checks that the sectors read contain MPEG packs, and passes the
+/// ones that do not as failed sectors with the InvalidPack outcome.
+class PackValidator {
+public:
+  /// Whether the sector starts with a MPEG pack header followed by a
+  /// PES packet.
+  static bool isValidPack(const unsigned char * buffer) {
+    int first_pes_offset = 13 + (buffer[13] & 0x7);
+    return buffer[2] == 1 && buffer[first_pes_offset + 3] == 1;
+  };
+
+  template<class Next>
+  void sectorsRead(int offset, int nb, unsigned char * buffer,
+                   const DVDFileData * dat, Next & next) {
+    int i = 0;
+    while(i < nb) {
+      bool valid = isValidPack(buffer + i * 2048);
+      int j = i + 1;
+      while(j < nb && isValidPack(buffer + j * 2048) == valid)
+        ++j;
+      if(valid)
+        next.sectorsRead(offset + i, j - i, buffer + i * 2048, dat);
+      else
+        next.sectorsFailed(offset + i, j - i, ReadAttempt::InvalidPack,
+                           dat);
+      i = j;
+    }
+  };
+
+  template<class Next>
+  void sectorsFailed(int offset, int nb, ReadAttempt::Outcome outcome,
+                     const DVDFileData * dat, Next & next) {
+    next.sectorsFailed(offset, nb, outcome, dat);
+  };
+
+  template<class Next>
+  unsigned char * readBuffer(int offset, int nb, Next & next) {
+    return next.readBuffer(offset, nb);
+  };
+};
+
+/// Writes the sectors to a DVDOutFile, at the position of the
+/// sectors; failed sectors are skipped, ie filled with zeros.
+///
+/// If the output file is mapped in memory, the sectors are read
+/// directly into the mapping when possible (see
+/// DVDOutFile::mappedSectors()), and the failed ones are cleared
+/// there.
+class OutputStage {
+  DVDOutFile & outfile;
+public:
+  /// The number of sectors skipped so far
+  int skipped;
+
+  OutputStage(DVDOutFile & out) : outfile(out), skipped(0) {;};
+
+  template<class Next>
+  void sectorsRead(int offset, int nb, unsigned char * buffer,
+                   const DVDFileData * dat, Next & next) {
+    outfile.writeSectors(reinterpret_cast<char*>(buffer), nb);
+    next.sectorsRead(offset, nb, buffer, dat);
+  };
+
+  template<class Next>
+  void sectorsFailed(int offset, int nb, ReadAttempt::Outcome outcome,
+                     const DVDFileData * dat, Next & next) {
+    outfile.skipSectors(nb);
+    outfile.checkpoint();
+    skipped += nb;
+    next.sectorsFailed(offset, nb, outcome, dat);
+  };
+
+  template<class Next>
+  unsigned char * readBuffer(int offset, int nb, Next & next) {
+    if(offset == outfile.currentSector()) {
+      unsigned char * buffer = outfile.mappedSectors(nb);
+      if(buffer)
+        return buffer;
+    }
+    return next.readBuffer(offset, nb);
+  };
+};
+
+#endif
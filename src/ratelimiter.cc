@@ -0,0 +1,83 @@
+/**
+    \file ratelimiter.cc
+    Implementation of the RateLimiter class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "ratelimiter.hh"
+
+#include <algorithm>
+
+/// The weight of the last read in the average read rate of a drive
+#define READ_RATE_WEIGHT 0.1
+
+RateLimiter::RateLimiter(double r, double b) :
+  rate(r), burst(b), last(std::chrono::steady_clock::now())
+{
+  if(! (rate > 0))
+    throw std::runtime_error("The output rate must be positive");
+  tokens = burst > 0 ? burst : rate/4;
+}
+
+double RateLimiter::currentRate() const
+{
+  double reading = 0;
+  for(const auto & r : readRates)
+    reading += r.second;
+  return std::max(rate, reading);
+}
+
+void RateLimiter::consume(size_t bytes)
+{
+  double wait;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::chrono::steady_clock::time_point now = 
+      std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = now - last;
+    last = now;
+    double current = currentRate();
+    tokens = std::min(burst > 0 ? burst : current/4, 
+                      tokens + elapsed.count() * current);
+    tokens -= bytes;
+    // The threads that come later wait longer, since they see a
+    // larger debt.
+    wait = tokens < 0 ? -tokens/current : 0;
+  }
+  if(wait > 0)
+    std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+}
+
+void RateLimiter::reportRead(const void * reader, size_t bytes, 
+                             double seconds)
+{
+  if(seconds <= 0)
+    return;
+  double r = bytes / seconds;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = readRates.find(reader);
+  if(it == readRates.end())
+    readRates[reader] = r;
+  else
+    it->second += READ_RATE_WEIGHT * (r - it->second);
+}
+
+void RateLimiter::forget(const void * reader)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  readRates.erase(reader);
+}
@@ -0,0 +1,75 @@
+/**
+    \file ratelimiter.hh
+    Limiting the rate of the output
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __RATELIMITER_H
+#define __RATELIMITER_H
+
+#include <chrono>
+
+/// A token bucket limiting the number of bytes per second going
+/// through it. It is shared by all the threads using it: they all
+/// wait in turn when the bucket is empty.
+///
+/// The limit never goes below the rate at which the drives being
+/// copied read (as reported by reportRead()), so that limiting the
+/// output does not slow them down (which would make them spin
+/// down). When they read slower, the limit goes back to the nominal
+/// rate.
+class RateLimiter {
+  std::mutex mutex;
+
+  /// The nominal number of bytes per second
+  double rate;
+
+  /// The number of bytes that can go through right away. It is
+  /// negative when the threads are waiting.
+  double tokens;
+
+  /// The maximum number of tokens, ie the size of the bursts, or 0
+  /// for a quarter of a second worth.
+  double burst;
+
+  /// When the tokens were last updated
+  std::chrono::steady_clock::time_point last;
+
+  /// The average read rates of the drives, in bytes per second
+  std::map<const void *, double> readRates;
+
+  /// The current limit, ie the largest of the nominal rate and of the
+  /// total read rate of the drives. The mutex must be held.
+  double currentRate() const;
+
+public:
+  /// A limiter letting @a rate bytes per second through, with bursts
+  /// of up to @a burst bytes (a quarter of a second worth if 0).
+  RateLimiter(double rate, double burst = 0);
+
+  /// Accounts for @a bytes bytes, waiting as long as necessary to
+  /// keep the rate.
+  void consume(size_t bytes);
+
+  /// Tells that the drive identified by @a reader just read @a bytes
+  /// bytes in @a seconds seconds.
+  void reportRead(const void * reader, size_t bytes, double seconds);
+
+  /// Forgets about the drive, when it is done reading.
+  void forget(const void * reader);
+};
+
+#endif
@@ -0,0 +1,267 @@
+/**
+    \file retryscheduler.cc
+    Implementation of the RetryScheduler class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "retryscheduler.hh"
+
+#include <algorithm>
+
+#include <stdio.h>
+
+/// The number of sectors in an ECC block
+#define ECC_BLOCK 16
+
+RetryScheduler::RetryScheduler() : interleave(1), backwards(false)
+{
+}
+
+void RetryScheduler::addRetry(const Retry & retry)
+{
+  retries.push_back(retry);
+}
+
+std::vector<Retry> RetryScheduler::schedule() const
+{
+  std::vector<Retry> sorted = retries;
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Retry & a, const Retry & b) -> bool {
+                     if(a.penalty != b.penalty)
+                       return a.penalty < b.penalty;
+                     return a.lba < b.lba;
+                   });
+
+  int step = (interleave > 1 ? interleave : 1);
+  bool down = backwards;
+  std::vector<Retry> retval;
+  retval.reserve(sorted.size());
+
+  auto group = sorted.begin();
+  while(group != sorted.end()) {
+    auto end = group;
+    while(end != sorted.end() && end->penalty == group->penalty)
+      ++end;
+
+    // Splits the group into ECC blocks, in ascending order
+    std::vector<std::pair<long, std::pair<int, int> > > blocks;
+    for(auto it = group; it != end; ) {
+      long block = it->lba / ECC_BLOCK;
+      auto beg = it;
+      while(it != end && it->lba / ECC_BLOCK == block)
+        ++it;
+      blocks.push_back(std::make_pair(block, 
+                                      std::make_pair(beg - sorted.begin(),
+                                                     it - sorted.begin())));
+    }
+
+    // Then, one sweep per interleave phase, alternating directions.
+    for(int phase = 0; phase < step; phase++) {
+      int nb = blocks.size();
+      for(int i = 0; i < nb; i++) {
+        const auto & b = blocks[down ? nb - 1 - i : i];
+        if(b.first % step != phase)
+          continue;
+        for(int j = b.second.first; j < b.second.second; j++)
+          retval.push_back(sorted[j]);
+      }
+      down = ! down;
+    }
+    group = end;
+  }
+  return retval;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+SharedRetryQueue::SharedRetryQueue(const std::vector<Retry> & schedule, 
+                                   int d) :
+  nextFresh(0), drives(d), aborted(false)
+{
+  if(drives < 1 || drives > 32)
+    throw std::logic_error("Invalid number of drives");
+  for(const Retry & r : schedule) {
+    index[std::pair<int, int>(r.file, r.sector)] = items.size();
+    items.push_back(Item(r));
+  }
+}
+
+bool SharedRetryQueue::isAvailable(size_t item, int drive) const
+{
+  const Item & it = items[item];
+  return ! (it.done || it.busy || (it.tried & (1U << drive)));
+}
+
+bool SharedRetryQueue::nextRun(int drive, int * file, int * start, int * nb)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while(! aborted) {
+    // First, the sectors other drives failed to read
+    size_t first = items.size();
+    for(auto it = failedElsewhere.begin(); it != failedElsewhere.end(); ) {
+      const Item & item = items[*it];
+      if(item.done || item.busy) {
+        // Not interesting anymore, or in use, which means it will be
+        // queued again if needed.
+        it = failedElsewhere.erase(it);
+        continue;
+      }
+      if(isAvailable(*it, drive)) {
+        first = *it;
+        failedElsewhere.erase(it);
+        break;
+      }
+      ++it;
+    }
+
+    // Then, the sectors nobody tried
+    if(first == items.size()) {
+      while(nextFresh < items.size() && ! (items[nextFresh].tried == 0 && 
+                                           isAvailable(nextFresh, drive)))
+        ++nextFresh;
+      first = nextFresh;
+    }
+
+    if(first < items.size()) {
+      size_t last = first + 1;
+      while(last < items.size() && isAvailable(last, drive) && 
+            items[last].retry.file == items[first].retry.file &&
+            items[last].retry.sector == items[last - 1].retry.sector + 1)
+        ++last;
+      for(size_t i = first; i < last; i++)
+        items[i].busy = true;
+      *file = items[first].retry.file;
+      *start = items[first].retry.sector;
+      *nb = last - first;
+      return true;
+    }
+
+    // Nothing for us right now. We wait if other drives are reading
+    // sectors we haven't tried yet.
+    bool wait = false;
+    for(const Item & item : items) {
+      if(item.busy && ! (item.tried & (1U << drive))) {
+        wait = true;
+        break;
+      }
+    }
+    if(! wait)
+      return false;
+    changed.wait(lock);
+  }
+  return false;
+}
+
+void SharedRetryQueue::abort()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  aborted = true;
+  changed.notify_all();
+}
+
+bool SharedRetryQueue::finish(int drive, int file, int sector, bool success)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  auto it = index.find(std::pair<int, int>(file, sector));
+  if(it == index.end())
+    throw std::logic_error("Finishing a sector that was not scheduled");
+  Item & item = items[it->second];
+  item.busy = false;
+  item.tried |= (1U << drive);
+  bool givenUp = false;
+  if(success)
+    item.done = true;
+  else if(item.tried == (drives == 32 ? ~0U : (1U << drives) - 1)) {
+    item.done = true;
+    givenUp = true;
+  }
+  else
+    failedElsewhere.push_back(it->second);
+  changed.notify_all();
+  return givenUp;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+RetryStrategy::RetryStrategy(int d, int s) : 
+  distance(d), size(s),
+  plainAttempts(0), plainSuccesses(0),
+  bustAttempts(0), bustSuccesses(0)
+{
+}
+
+/// The number of attempts each approach gets before we start
+/// comparing them
+#define MIN_ATTEMPTS 4
+
+/// One retry out of that many uses the approach that looks worse.
+#define EXPLORE_EVERY 10
+
+bool RetryStrategy::shouldBust() const
+{
+  if(distance <= 0 || size <= 0)
+    return false;
+  if(plainAttempts < MIN_ATTEMPTS || bustAttempts < MIN_ATTEMPTS)
+    return bustAttempts <= plainAttempts;
+
+  // Laplace-smoothed success rates
+  double plain = (plainSuccesses + 1.0)/(plainAttempts + 2.0);
+  double bust = (bustSuccesses + 1.0)/(bustAttempts + 2.0);
+  bool best = bust > plain;
+  if((plainAttempts + bustAttempts) % EXPLORE_EVERY == EXPLORE_EVERY - 1)
+    return ! best;
+  return best;
+}
+
+void RetryStrategy::recordOutcome(bool busted, bool success)
+{
+  if(busted) {
+    ++bustAttempts;
+    if(success)
+      ++bustSuccesses;
+  }
+  else {
+    ++plainAttempts;
+    if(success)
+      ++plainSuccesses;
+  }
+}
+
+int RetryStrategy::farSector(int sector, int fileSize) const
+{
+  int far = sector + distance;
+  if(far + size > fileSize)
+    far = sector - distance - size;
+  if(far < 0)
+    far = (sector >= fileSize/2 ? 0 : fileSize - size);
+  if(far < 0)
+    far = 0;
+  return far;
+}
+
+void RetryStrategy::writeSummary(const std::string & device) const
+{
+  if(plainAttempts + bustAttempts == 0)
+    return;
+  if(! device.empty())
+    printf("\nRetries on %s:", device.c_str());
+  else
+    printf("\nRetries:");
+  printf(" %d/%d plain retries succeeded, "
+         "%d/%d after reading elsewhere\n",
+         plainSuccesses, plainAttempts, bustSuccesses, bustAttempts);
+}
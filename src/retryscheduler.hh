@@ -0,0 +1,203 @@
+/**
+    \file retryscheduler.hh
+    The RetryScheduler class, ordering the reads of the second pass
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __RETRYSCHEDULER_H
+#define __RETRYSCHEDULER_H
+
+/// A sector to be read again
+class Retry {
+public:
+  /// The index of the file in the list of files
+  int file;
+
+  /// The sector, relative to the beginning of the file
+  int sector;
+
+  /// The (approximate) physical position of the sector on the disc
+  long lba;
+
+  /// The priority of the retry: lower values are read first (see
+  /// BadSectorsFile::retryPenalty())
+  int penalty;
+
+  Retry(int f, int s, long l, int p) :
+    file(f), sector(s), lba(l), penalty(p) {;};
+};
+
+/// Orders the retries of the second pass so as to minimize the time
+/// spent seeking.
+///
+/// Retries are grouped by priority, and each group is read in
+/// elevator sweeps: the head goes up the disc, then down, and so
+/// on, never going back within a sweep.
+///
+/// Reading right after a failed sector a sector in the same ECC
+/// block often just gets the failure the drive keeps in its cache.
+/// To avoid that, the ECC blocks can be interleaved: with an
+/// interleave of N, each sweep only visits one ECC block out of N,
+/// and N sweeps are needed to go through all the blocks. The bad
+/// sectors of a given ECC block are always read in a row, in
+/// ascending order, so that they can be read in one go.
+class RetryScheduler {
+protected:
+
+  /// The retries to schedule
+  std::vector<Retry> retries;
+
+public:
+
+  /// The number of ECC blocks between two blocks read in a row (1
+  /// means no interleaving).
+  int interleave;
+
+  /// Whether the first sweep goes down rather than up.
+  bool backwards;
+
+  RetryScheduler();
+
+  /// Adds a sector to be read
+  void addRetry(const Retry & retry);
+
+  /// Returns the retries, in the order in which they should be done.
+  std::vector<Retry> schedule() const;
+
+  /// The number of retries
+  size_t size() const {
+    return retries.size();
+  };
+};
+
+/// The retries shared between several drives reading the same disc.
+///
+/// Each drive gets runs of consecutive sectors it has not tried yet,
+/// the sectors that other drives failed to read coming first. A
+/// sector is done as soon as one drive reads it, or when all the
+/// drives have failed.
+///
+/// All the functions are thread-safe.
+class SharedRetryQueue {
+  /// The state of a retry
+  class Item {
+  public:
+    Retry retry;
+
+    /// The drives that tried this sector, as a bit mask
+    unsigned tried;
+
+    /// Whether a drive is currently reading this sector
+    bool busy;
+
+    /// Whether the sector was read, or all drives failed
+    bool done;
+
+    Item(const Retry & r) : retry(r), tried(0), busy(false), done(false) {;};
+  };
+
+  /// The retries, in the scheduled order
+  std::vector<Item> items;
+
+  /// The index of the items by file and sector
+  std::map<std::pair<int, int>, size_t> index;
+
+  /// The items that some drives failed to read, but not all.
+  std::deque<size_t> failedElsewhere;
+
+  /// All the items before that were taken already
+  size_t nextFresh;
+
+  /// The number of drives
+  int drives;
+
+  /// Whether the work was aborted
+  bool aborted;
+
+  std::mutex mutex;
+  std::condition_variable changed;
+
+  /// Whether the item can be given to the drive.
+  bool isAvailable(size_t item, int drive) const;
+
+public:
+  /// Creates a queue for the given schedule, shared between @a drives
+  /// drives (at most 32).
+  SharedRetryQueue(const std::vector<Retry> & schedule, int drives);
+
+  /// Gets the next run of sectors for the given drive: @a nb sectors
+  /// starting from @a start in the file @a file. It waits for the
+  /// other drives if the only sectors left are being tried by them,
+  /// and returns false when there is nothing left for this drive.
+  bool nextRun(int drive, int * file, int * start, int * nb);
+
+  /// Reports the outcome of the read of the given sector by the given
+  /// drive. Returns true if the sector is given up, ie all the drives
+  /// failed to read it.
+  bool finish(int drive, int file, int sector, bool success);
+
+  /// Stops the work: nextRun() returns false from now on. This is
+  /// used when one of the drives hits an unrecoverable error.
+  void abort();
+};
+
+/// Decides how to retry a sector that just failed.
+///
+/// Drives often serve a retry of a sector that just failed from
+/// their cache (or their error state), in which case retrying right
+/// away is just a waste of time. Reading @a size sectors @a distance
+/// sectors away first usually forces the drive to really read the
+/// sector again, but it costs a seek.
+///
+/// The choice between the two approaches is made from their measured
+/// success rates, trying the other approach from time to time in
+/// case things change.
+class RetryStrategy {
+public:
+  /// The distance of the "cache-busting" read, in sectors. Zero or
+  /// less disables cache-busting.
+  int distance;
+
+  /// The number of sectors of the cache-busting read.
+  int size;
+
+  /// Number of plain retries, and how many succeeded
+  int plainAttempts;
+  int plainSuccesses;
+
+  /// Number of retries after a cache-busting read, and how many
+  /// succeeded
+  int bustAttempts;
+  int bustSuccesses;
+
+  RetryStrategy(int distance = 4096, int size = 16);
+
+  /// Whether the next retry should be done after a cache-busting read
+  bool shouldBust() const;
+
+  /// Records the outcome of a retry
+  void recordOutcome(bool busted, bool success);
+
+  /// Returns the first sector of the cache-busting read for a retry
+  /// of @a sector in a file of @a fileSize sectors.
+  int farSector(int sector, int fileSize) const;
+
+  /// Writes a short summary of the success rates, for the given
+  /// device if not empty.
+  void writeSummary(const std::string & device = "") const;
+};
+
+#endif
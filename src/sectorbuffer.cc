@@ -0,0 +1,125 @@
+/**
+    \file sectorbuffer.cc
+    Implementation of the SectorArena and SectorBuffer classes
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "sectorbuffer.hh"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define SECTOR_SIZE 2048
+
+/// The alignment of the buffers (a page)
+#define ALIGNMENT 4096
+
+/// The alignment of the buffers backed by huge pages, which are used
+/// for buffers at least that large.
+#define HUGE_PAGE_SIZE (2*1024*1024)
+
+/// The number of buffers of each size kept for later use
+#define MAX_FREE 8
+
+class SectorBuffer::Block {
+public:
+  SectorArena * arena;
+  unsigned char * data;
+  int sectors;
+
+  Block(SectorArena * a, unsigned char * d, int s) :
+    arena(a), data(d), sectors(s) {;};
+
+  ~Block() {
+    arena->release(data, sectors);
+  };
+};
+
+SectorBuffer SectorBuffer::slice(int first, int nb) const
+{
+  if(first < 0 || nb < 0 || first + nb > sectors)
+    throw std::logic_error("Slice out of the buffer");
+  SectorBuffer ret(*this);
+  ret.start = sector(first);
+  ret.sectors = nb;
+  return ret;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+SectorArena::SectorArena() : hugePages(false)
+{
+}
+
+SectorArena & SectorArena::global()
+{
+  static SectorArena arena;
+  return arena;
+}
+
+SectorBuffer SectorArena::allocate(int sectors)
+{
+  int rounded = 1;
+  while(rounded < sectors)
+    rounded *= 2;
+
+  unsigned char * data = NULL;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<unsigned char *> & fr = freeBuffers[rounded];
+    if(fr.size() > 0) {
+      data = fr.back();
+      fr.pop_back();
+    }
+  }
+
+  if(! data) {
+    size_t size = (size_t) rounded * SECTOR_SIZE;
+    bool huge = hugePages && size >= HUGE_PAGE_SIZE;
+    void * ptr;
+    if(posix_memalign(&ptr, huge ? HUGE_PAGE_SIZE : ALIGNMENT, size))
+      throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+    if(huge)
+      madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    data = static_cast<unsigned char *>(ptr);
+  }
+
+  SectorBuffer ret;
+  ret.block = std::make_shared<SectorBuffer::Block>(this, data, rounded);
+  ret.start = data;
+  ret.sectors = sectors;
+  return ret;
+}
+
+void SectorArena::release(unsigned char * data, int sectors)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<unsigned char *> & fr = freeBuffers[sectors];
+  if(fr.size() < MAX_FREE)
+    fr.push_back(data);
+  else
+    free(data);
+}
+
+SectorArena::~SectorArena()
+{
+  for(auto it = freeBuffers.begin(); it != freeBuffers.end(); ++it)
+    for(unsigned char * data : it->second)
+      free(data);
+}
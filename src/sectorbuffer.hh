@@ -0,0 +1,104 @@
+/**
+    \file sectorbuffer.hh
+    Pooled and aligned buffers for sectors
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __SECTORBUFFER_H
+#define __SECTORBUFFER_H
+
+class SectorArena;
+
+/// A reference-counted slice of sectors of a buffer coming from a
+/// SectorArena. Copies share the same memory, which goes back to the
+/// arena when the last of them is destroyed, so that a buffer can be
+/// handed over to another thread without copying the data.
+class SectorBuffer {
+public:
+  /// The memory, as allocated by the arena
+  class Block;
+
+protected:
+  std::shared_ptr<Block> block;
+
+  /// The first byte of the slice
+  unsigned char * start;
+
+  /// The number of sectors of the slice
+  int sectors;
+
+  friend class SectorArena;
+
+public:
+  /// An empty buffer
+  SectorBuffer() : start(NULL), sectors(0) {;};
+
+  /// The data
+  unsigned char * data() const {
+    return start;
+  };
+
+  /// The given sector within the buffer
+  unsigned char * sector(int i) const {
+    return start + i * 2048;
+  };
+
+  /// The number of sectors
+  int size() const {
+    return sectors;
+  };
+
+  /// Returns the @a nb sectors starting from @a first, sharing the
+  /// memory of this buffer.
+  SectorBuffer slice(int first, int nb) const;
+};
+
+/// A pool of sector buffers aligned on page boundaries (which makes
+/// them suitable for O_DIRECT), to avoid allocating memory when
+/// reading.
+///
+/// The buffers are sorted by size, rounded up to a power of two
+/// sectors. All functions are thread-safe.
+class SectorArena {
+  std::mutex mutex;
+
+  /// The free buffers, by number of sectors
+  std::map<int, std::vector<unsigned char *> > freeBuffers;
+
+  /// Gives back the memory of a block
+  void release(unsigned char * data, int sectors);
+
+  friend class SectorBuffer::Block;
+
+public:
+
+  /// If true, large buffers are backed by huge pages where the
+  /// system supports it.
+  bool hugePages;
+
+  SectorArena();
+
+  /// Returns a buffer of at least @a sectors sectors (exactly that
+  /// many as far as SectorBuffer::size() is concerned).
+  SectorBuffer allocate(int sectors);
+
+  /// The arena used throughout the program.
+  static SectorArena & global();
+
+  ~SectorArena();
+};
+
+#endif
@@ -0,0 +1,262 @@
+/**
+    \file sessionlog.cc
+    Implementation of the recording and the replay of sessions
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "headers.hh"
+#include "sessionlog.hh"
+#include "dvdreader.hh"
+
+#include <stdio.h>
+
+static const char magic[] = "DVDCSES1";
+
+/// The size of the fingerprints (see DVDSource::fingerprint())
+#define FINGERPRINT_SIZE 16
+
+/// Reads the header of the session log @a in, and checks it is
+/// for the disc with the given @a fingerprint.
+static void checkHeader(FILE * in, const std::string & file, 
+                        const std::string & fingerprint)
+{
+  char buf[8 + FINGERPRINT_SIZE];
+  if(fread(buf, 1, sizeof(buf), in) != sizeof(buf) || 
+     memcmp(buf, magic, 8))
+    throw std::runtime_error("'" + file + "' is not a session log");
+  if(std::string(buf + 8, FINGERPRINT_SIZE) != fingerprint)
+    throw std::runtime_error("The session in '" + file + 
+                             "' was recorded on another disc");
+}
+
+SessionRecorder::SessionRecorder(const std::string & file, 
+                                 const std::string & fingerprint)
+{
+  if(fingerprint.size() != FINGERPRINT_SIZE)
+    throw std::runtime_error("Invalid disc fingerprint");
+  out = fopen(file.c_str(), "rb");
+  if(out) {
+    try {
+      checkHeader(out, file, fingerprint);
+    }
+    catch(...) {
+      fclose(out);
+      throw;
+    }
+    fclose(out);
+    out = fopen(file.c_str(), "ab");
+    printf("Adding the reads to the session in '%s'\n", file.c_str());
+  }
+  else {
+    out = fopen(file.c_str(), "wb");
+    if(out) {
+      fwrite(magic, 1, 8, out);
+      fwrite(fingerprint.c_str(), 1, FINGERPRINT_SIZE, out);
+    }
+  }
+  if(! out) {
+    std::string err = "Could not write session log '" + file + "': " + 
+      strerror(errno);
+    throw std::runtime_error(err);
+  }
+}
+
+void SessionRecorder::record(const SessionRecord & rec)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  fwrite(&rec, sizeof(rec), 1, out);
+  fflush(out);
+}
+
+SessionRecorder::~SessionRecorder()
+{
+  fclose(out);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+DVDRecordingFile::DVDRecordingFile(DVDFile * r, SessionRecorder * rc,
+                                   const DVDFileData * dat) :
+  DVDFile(NULL, dat), real(r), recorder(rc)
+{
+}
+
+int DVDRecordingFile::readBlocks(int offset, int blocks, 
+                                 unsigned char * dest)
+{
+  std::chrono::steady_clock::time_point before = 
+    std::chrono::steady_clock::now();
+  int result = real->readBlocks(offset, blocks, dest);
+  std::chrono::duration<double, std::micro> elapsed = 
+    std::chrono::steady_clock::now() - before;
+
+  SessionRecord rec;
+  rec.title = dat->title;
+  rec.domain = dat->domain;
+  rec.sector = offset;
+  rec.blocks = blocks;
+  rec.result = result;
+  rec.latency = std::min(elapsed.count(), 4e9);
+  recorder->record(rec);
+  return result;
+}
+
+int DVDRecordingFile::fileSize()
+{
+  return real->fileSize();
+}
+
+//////////////////////////////////////////////////////////////////////
+
+ReplayedDrive::ReplayedDrive(const std::string & file, 
+                             const std::string & fingerprint) :
+  defaultLatency(0), driveTime(0), reads(0), failures(0), speed(0)
+{
+  FILE * in = fopen(file.c_str(), "rb");
+  if(! in) {
+    std::string err = "Could not read session log '" + file + "': " + 
+      strerror(errno);
+    throw std::runtime_error(err);
+  }
+  try {
+    checkHeader(in, file, fingerprint);
+  }
+  catch(...) {
+    fclose(in);
+    throw;
+  }
+  SessionRecord rec;
+  while(fread(&rec, sizeof(rec), 1, in) == 1)
+    if(rec.sector >= 0 && rec.blocks > 0)
+      records.push_back(rec);
+  fclose(in);
+
+  // First, the number of records of each sector, and then where
+  // they are.
+  double total = 0;
+  long good = 0;
+  for(const SessionRecord & r : records) {
+    FileLog & log = files[std::make_pair(r.title, r.domain)];
+    if((int) log.sectors.size() < r.sector + r.blocks)
+      log.sectors.resize(r.sector + r.blocks, Sector());
+    for(int s = r.sector; s < r.sector + r.blocks; s++)
+      if(log.sectors[s].count < 0xffff)
+        log.sectors[s].count++;
+    if(r.result == r.blocks) {
+      total += 1e-6 * r.latency;
+      good += r.blocks;
+    }
+  }
+  if(good > 0)
+    defaultLatency = total/good;
+
+  for(auto & f : files) {
+    FileLog & log = f.second;
+    uint32_t first = 0;
+    for(Sector & s : log.sectors) {
+      s.first = first;
+      first += s.count;
+    }
+    log.records.resize(first);
+  }
+  for(uint32_t i = 0; i < records.size(); i++) {
+    const SessionRecord & r = records[i];
+    FileLog & log = files[std::make_pair(r.title, r.domain)];
+    for(int s = r.sector; s < r.sector + r.blocks; s++) {
+      Sector & sec = log.sectors[s];
+      if(sec.next < sec.count)
+        log.records[sec.first + sec.next++] = i;
+    }
+  }
+  for(auto & f : files)
+    for(Sector & s : f.second.sectors)
+      s.next = 0;
+  printf("Replaying the %ld reads of the session in '%s'\n",
+         (long) records.size(), file.c_str());
+}
+
+int ReplayedDrive::read(const DVDFileData * file, int offset, int blocks)
+{
+  double latency = 0;
+  int good = 0;
+  bool failed = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = files.find(std::make_pair(file->title, (int) file->domain));
+    for(int s = offset; s < offset + blocks; s++) {
+      bool ok = true;
+      double lat = defaultLatency;
+      if(it != files.end() && s < (int) it->second.sectors.size()) {
+        FileLog & log = it->second;
+        Sector & sec = log.sectors[s];
+        if(sec.count > 0) {
+          const SessionRecord & rec = 
+            records[log.records[sec.first + sec.next]];
+          if(sec.next + 1 < sec.count)
+            sec.next++;
+          ok = rec.result > s - rec.sector;
+          lat = 1e-6 * rec.latency / rec.blocks;
+        }
+      }
+      latency += lat;
+      if(! ok)
+        failed = true;
+      else if(! failed)
+        ++good;
+    }
+    driveTime += latency;
+    ++reads;
+    if(failed)
+      ++failures;
+  }
+  if(speed > 0)
+    std::this_thread::sleep_for(std::chrono::duration<double>
+                                (latency/speed));
+  if(! failed)
+    return blocks;
+  return good > 0 ? good : -1;
+}
+
+ReplayedDrive::~ReplayedDrive()
+{
+  printf("\nReplayed %ld reads (%ld failed), which would have taken "
+         "%.1f seconds on the drive\n", reads, failures, driveTime);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+DVDReplayedFile::DVDReplayedFile(DVDFile * r, ReplayedDrive * d,
+                                 const DVDFileData * dat) :
+  DVDFile(NULL, dat), real(r), drive(d)
+{
+}
+
+int DVDReplayedFile::readBlocks(int offset, int blocks, 
+                                unsigned char * dest)
+{
+  int nb = drive->read(dat, offset, blocks);
+  if(nb <= 0)
+    return -1;
+  int rd = real->readBlocks(offset, nb, dest);
+  return rd < nb ? -1 : nb;
+}
+
+int DVDReplayedFile::fileSize()
+{
+  return real->fileSize();
+}
@@ -0,0 +1,169 @@
+/**
+    \file sessionlog.hh
+    Recording of the reads of a source, and their replay
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef __SESSIONLOG_H
+#define __SESSIONLOG_H
+
+#include "dvdfile.hh"
+
+#include <stdint.h>
+
+/// A read request, as recorded in session logs.
+///
+/// The session log starts with the @a DVDCSES1 magic and the
+/// fingerprint of the disc (see DVDSource::fingerprint()), followed
+/// by the records, in the native byte order.
+struct SessionRecord {
+  /// The file (see DVDFileData)
+  int16_t title;
+  int16_t domain;
+
+  /// The first sector, within the file, and the number of sectors
+  int32_t sector;
+  int32_t blocks;
+
+  /// What DVDFile::readBlocks() returned
+  int32_t result;
+
+  /// The time it took, in microseconds
+  uint32_t latency;
+};
+
+/// Writes the log of all the reads of a source, to replay them
+/// later (see ReplayedDrive).
+class SessionRecorder {
+  FILE * out;
+
+  std::mutex mutex;
+
+public:
+  /// Records the session in @a file. If it already holds a session
+  /// for the disc with the @a fingerprint, the reads are added to it.
+  SessionRecorder(const std::string & file, const std::string & fingerprint);
+
+  /// Writes a record. The log is flushed each time, so that it is
+  /// there even if dvdcopy gets killed because the drive hangs.
+  void record(const SessionRecord & rec);
+
+  ~SessionRecorder();
+};
+
+/// A DVDFile whose reads are recorded by a SessionRecorder.
+class DVDRecordingFile : public DVDFile {
+  std::unique_ptr<DVDFile> real;
+
+  SessionRecorder * recorder;
+
+public:
+  /// Takes ownership of @a real.
+  DVDRecordingFile(DVDFile * real, SessionRecorder * recorder,
+                   const DVDFileData * dat);
+
+  virtual int readBlocks(int offset, int blocks, unsigned char * dest);
+
+  virtual int fileSize();
+};
+
+/// A drive that behaves as recorded in a session log, so that reading
+/// strategies can be tried offline against the damage of a real
+/// disc.
+///
+/// Each sector goes through the outcomes of the recorded reads that
+/// covered it, in order: a read succeeds if all its sectors do (or
+/// returns the number of the first sectors that do), and it takes
+/// the share of the latency of the recorded reads of its sectors.
+/// When the outcomes of a sector are all used up, it keeps behaving
+/// like the last one; sectors that were never read are read fine.
+/// Replaying the session with the same options gives exactly the
+/// same reads, and the replay is deterministic in any case.
+class ReplayedDrive {
+  /// The records
+  std::vector<SessionRecord> records;
+
+  /// What is known about a sector of a file
+  struct Sector {
+    /// The position of its first record in FileLog::records
+    uint32_t first;
+    /// The number of records
+    uint16_t count;
+    /// The next one to replay
+    uint16_t next;
+  };
+
+  /// The records of each file, by sector
+  struct FileLog {
+    std::vector<Sector> sectors;
+    /// The indices of the records, sector after sector
+    std::vector<uint32_t> records;
+  };
+
+  std::map<std::pair<int, int>, FileLog> files;
+
+  /// The latency of sectors that were never read, in seconds: the
+  /// average of those that were read fine.
+  double defaultLatency;
+
+  /// The time the replayed reads would have taken on the drive, in
+  /// seconds, and how many there were.
+  double driveTime;
+  long reads;
+  long failures;
+
+  std::mutex mutex;
+
+public:
+
+  /// Loads the session from @a file, and checks that it was recorded
+  /// on the disc with the given @a fingerprint.
+  ReplayedDrive(const std::string & file, const std::string & fingerprint);
+
+  /// If positive, the reads take their recorded time divided by
+  /// speed, so that the progress looks as it did. By default, they
+  /// return at once.
+  double speed;
+
+  /// Replays a read of @a blocks sectors at @a offset in @a file, and
+  /// returns the number of sectors read, or -1.
+  int read(const DVDFileData * file, int offset, int blocks);
+
+  /// Shows how long the replayed reads would have taken.
+  ~ReplayedDrive();
+};
+
+/// A DVDFile that reads through a ReplayedDrive: the data come from
+/// the real file, but the errors and the latency come from the
+/// session log.
+class DVDReplayedFile : public DVDFile {
+  std::unique_ptr<DVDFile> real;
+
+  ReplayedDrive * drive;
+
+public:
+  /// Takes ownership of @a real.
+  DVDReplayedFile(DVDFile * real, ReplayedDrive * drive,
+                  const DVDFileData * dat);
+
+  virtual int readBlocks(int offset, int blocks, unsigned char * dest);
+
+  virtual int fileSize();
+};
+
+#endif
@@ -0,0 +1,128 @@
+/**
+    \file simulateddrive.cc
+    Implementation of the SimulatedDrive and DVDSimulatedFile classes
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "simulateddrive.hh"
+#include "dvdreader.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+SimulatedDrive::SimulatedDrive(const std::string & spec, int stream) :
+  recoveryProbability(0), cacheSize(256), seed(1), 
+  cachedFile(NULL), cachedStart(0), cachedEnd(0)
+{
+  std::string rest = spec;
+  while(! rest.empty()) {
+    size_t idx = rest.find(',');
+    std::string item = rest.substr(0, idx);
+    rest = (idx == std::string::npos ? "" : rest.substr(idx + 1));
+
+    size_t eq = item.find('=');
+    if(eq == std::string::npos) 
+      throw std::runtime_error("Invalid drive simulation item: '" + 
+                               item + "'");
+    std::string key = item.substr(0, eq);
+    std::string value = item.substr(eq + 1);
+    if(key == "bad") {
+      std::string ranges = value;
+      while(! ranges.empty()) {
+        size_t i = ranges.find(':');
+        std::string range = ranges.substr(0, i);
+        ranges = (i == std::string::npos ? "" : ranges.substr(i + 1));
+        int first, last;
+        int nb = sscanf(range.c_str(), "%d-%d", &first, &last);
+        if(nb < 1)
+          throw std::runtime_error("Invalid range of bad sectors: '" + 
+                                   range + "'");
+        if(nb == 1)
+          last = first;
+        badRanges.push_back(std::pair<int, int>(first, last));
+      }
+    }
+    else if(key == "p")
+      recoveryProbability = atof(value.c_str());
+    else if(key == "cache")
+      cacheSize = atoi(value.c_str());
+    else if(key == "seed")
+      seed = atoi(value.c_str());
+    else
+      throw std::runtime_error("Unknown drive simulation parameter: '" + 
+                               key + "'");
+  }
+  seed += stream;
+}
+
+bool SimulatedDrive::isDamaged(const DVDFileData * file, int sector) const
+{
+  if(file->isIFO())
+    return false;
+  for(const auto & r : badRanges)
+    if(sector >= r.first && sector <= r.second)
+      return true;
+  return false;
+}
+
+/// The number of sectors in an ECC block: the drive always reads
+/// whole blocks.
+#define ECC_BLOCK 16
+
+bool SimulatedDrive::read(const DVDFileData * file, int offset, int blocks)
+{
+  bool cached = file == cachedFile && 
+    offset >= cachedStart && offset + blocks <= cachedEnd;
+  if(! cached) {
+    // The drive really reads, starting from the ECC block of the
+    // first sector, and reads ahead to fill its cache.
+    cachedFile = file;
+    cachedStart = offset - offset % ECC_BLOCK;
+    cachedEnd = cachedStart + cacheSize;
+    if(cachedEnd < offset + blocks)
+      cachedEnd = offset + blocks;
+    cachedFailures.clear();
+    for(int s = cachedStart; s < cachedEnd; s++) {
+      if(isDamaged(file, s) && 
+         rand_r(&seed) >= recoveryProbability * (RAND_MAX + 1.0))
+        cachedFailures.insert(s);
+    }
+  }
+  auto it = cachedFailures.lower_bound(offset);
+  return it == cachedFailures.end() || *it >= offset + blocks;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+DVDSimulatedFile::DVDSimulatedFile(DVDFile * r, SimulatedDrive * d,
+                                   const DVDFileData * dat) :
+  DVDFile(NULL, dat), real(r), drive(d)
+{
+}
+
+int DVDSimulatedFile::readBlocks(int offset, int blocks, 
+                                 unsigned char * dest)
+{
+  if(! drive->read(dat, offset, blocks))
+    return -1;
+  return real->readBlocks(offset, blocks, dest);
+}
+
+int DVDSimulatedFile::fileSize()
+{
+  return real->fileSize();
+}
@@ -0,0 +1,95 @@
+/**
+    \file simulateddrive.hh
+    A simulated damaged disc, to test reading strategies
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __SIMULATEDDRIVE_H
+#define __SIMULATEDDRIVE_H
+
+#include "dvdfile.hh"
+
+/// A model of a damaged disc in a drive that has a cache.
+///
+/// Some ranges of sectors of the VOB files are damaged: reading them
+/// only succeeds with a given probability. On top of that, the drive
+/// reads ahead a window of sectors starting from the last read that
+/// was not in its cache, and serves reads within that window from the
+/// cache, including the failures.
+///
+/// It is set up from a specification such as:
+///
+///   bad=100-110:500-502,p=0.3,cache=256,seed=1
+class SimulatedDrive {
+protected:
+  /// The damaged ranges (first and last sectors, included)
+  std::vector<std::pair<int, int> > badRanges;
+
+  /// The probability that reading a damaged sector succeeds
+  double recoveryProbability;
+
+  /// The size of the cache window, in sectors
+  int cacheSize;
+
+  /// The state of the random number generator
+  unsigned int seed;
+
+  /// The file whose sectors are in the cache, or NULL.
+  const DVDFileData * cachedFile;
+
+  /// The first sector of the cache window
+  int cachedStart;
+
+  /// The sector after the last one of the cache window
+  int cachedEnd;
+
+  /// The sectors within the cache window that failed to read.
+  std::set<int> cachedFailures;
+
+  /// Whether the sector is damaged
+  bool isDamaged(const DVDFileData * file, int sector) const;
+
+public:
+
+  /// Sets up the simulation. @a stream is added to the seed, so
+  /// that different drives get different random numbers.
+  SimulatedDrive(const std::string & spec, int stream = 0);
+
+  /// Simulates a read of @a blocks sectors at @a offset in @a file,
+  /// and returns whether it succeeded.
+  bool read(const DVDFileData * file, int offset, int blocks);
+};
+
+/// A DVDFile that reads through a SimulatedDrive: the data come
+/// from the real file, but the errors come from the simulation.
+class DVDSimulatedFile : public DVDFile {
+  /// The real file
+  std::unique_ptr<DVDFile> real;
+
+  /// The simulated drive
+  SimulatedDrive * drive;
+
+public:
+  /// Creates a simulated file. It takes ownership of @a real.
+  DVDSimulatedFile(DVDFile * real, SimulatedDrive * drive, 
+                   const DVDFileData * dat);
+
+  virtual int readBlocks(int offset, int blocks, unsigned char * dest);
+
+  virtual int fileSize();
+};
+
+#endif
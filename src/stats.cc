@@ -0,0 +1,108 @@
+/**
+    \file stats.cc
+    Implementation of the Stats class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "headers.hh"
+#include "stats.hh"
+
+#include <math.h>
+
+/// The number of buckets of the histograms of the timers: 4 per
+/// power of two nanoseconds, up to about 20 minutes
+#define NB_BUCKETS 160
+
+bool Stats::enabled = false;
+
+/// The measures of one timer
+class TimerData {
+public:
+  std::atomic<long long> count;
+  std::atomic<long long> total;
+  std::atomic<long long> buckets[NB_BUCKETS];
+
+  TimerData() : count(0), total(0) {
+    for(std::atomic<long long> & b : buckets)
+      b = 0;
+  };
+};
+
+static TimerData timers[Stats::NbTimers];
+
+static const char * timerNames[Stats::NbTimers] = {
+  "DVDReadBlocks",
+  "DVDReadBytes",
+  "direct reads",
+  "DVDOpenFile",
+  "writeSectors",
+  "output opens",
+  "bad sectors writes",
+  "progress display"
+};
+
+/// The bucket of the given duration
+static int bucketOf(long long ns)
+{
+  if(ns < 4)
+    return 0;
+  int octave = 63 - __builtin_clzll(ns);
+  int b = octave * 4 + ((ns >> (octave - 2)) & 3);
+  return std::min(b, NB_BUCKETS - 1);
+}
+
+/// The upper bound of the bucket, in nanoseconds
+static double bucketBound(int b)
+{
+  int octave = b / 4;
+  return ldexp(4 + (b % 4) + 1, octave - 2);
+}
+
+void Stats::record(Timer timer, long long ns)
+{
+  TimerData & t = timers[timer];
+  ++t.count;
+  t.total += ns;
+  ++t.buckets[bucketOf(ns)];
+}
+
+/// The duration below which @a q of the measures are, in seconds
+static double percentile(const TimerData & t, double q)
+{
+  long long target = (long long) ceil(q * t.count);
+  long long seen = 0;
+  for(int i = 0; i < NB_BUCKETS; i++) {
+    seen += t.buckets[i];
+    if(seen >= target)
+      return bucketBound(i) * 1e-9;
+  }
+  return bucketBound(NB_BUCKETS - 1) * 1e-9;
+}
+
+void Stats::report(FILE * out)
+{
+  fprintf(out, "\n%-20s %10s %12s %12s %12s\n", "Timer", "count",
+          "total (s)", "p50 (ms)", "p99 (ms)");
+  for(int i = 0; i < NbTimers; i++) {
+    const TimerData & t = timers[i];
+    if(t.count == 0)
+      continue;
+    fprintf(out, "%-20s %10lld %12.3f %12.3f %12.3f\n", timerNames[i],
+            (long long) t.count, t.total * 1e-9, 
+            percentile(t, 0.5) * 1e3, percentile(t, 0.99) * 1e3);
+  }
+}
@@ -0,0 +1,92 @@
+/**
+    \file stats.hh
+    Timers on the hot paths
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <stdio.h>
+
+/// Timers on the hot paths (reads, writes, bookkeeping), to tell
+/// what limits a copy, reported at the end with --stats.
+///
+/// The timers are only compiled in when configured with
+/// --enable-stats (which defines WITH_STATS); otherwise, STATS_TIMER
+/// expands to nothing. Even then, they only take time when enabled.
+class Stats {
+public:
+  /// What is timed
+  enum Timer {
+    /// DVDReadBlocks() and DVDReadBytes()
+    ReadBlocks,
+    ReadBytes,
+    /// The reads of files accessed directly (see DVDPlainFile),
+    /// including the wait for the reads ahead
+    DirectRead,
+    /// DVDOpenFile()
+    OpenFile,
+    /// DVDOutFile::writeSectors(), including the opening of the next
+    /// file when needed
+    WriteSectors,
+    /// The opening of output files
+    OpenOutput,
+    /// BadSectorsFile::writeOut()
+    BadSectorsWrite,
+    /// Showing the progress
+    ProgressRender,
+    NbTimers
+  };
+
+  /// Whether the timers take measures
+  static bool enabled;
+
+  /// Records that @a timer took @a ns nanoseconds.
+  static void record(Timer timer, long long ns);
+
+  /// Writes the number of measures, the total time and the median and
+  /// 99th percentile of each timer to @a out.
+  static void report(FILE * out);
+
+  /// Times its own lifetime, if the timers are enabled.
+  class Scope {
+    Timer timer;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+  public:
+    Scope(Timer t) : timer(t), active(enabled) {
+      if(active)
+        start = std::chrono::steady_clock::now();
+    };
+
+    ~Scope() {
+      if(active)
+        record(timer, std::chrono::duration_cast<std::chrono::nanoseconds>
+               (std::chrono::steady_clock::now() - start).count());
+    };
+  };
+};
+
+#ifdef WITH_STATS
+/// Times the rest of the current scope with the given Stats::Timer
+#define STATS_TIMER(timer) Stats::Scope statsScope(Stats::timer)
+#else
+#define STATS_TIMER(timer)
+#endif
+
+#endif
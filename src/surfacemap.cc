@@ -0,0 +1,100 @@
+/**
+    \file surfacemap.cc
+    Implementation of the SurfaceMap class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "headers.hh"
+#include "surfacemap.hh"
+
+#include <stdio.h>
+
+static const char magic[] = "DVDCMAP1";
+
+void SurfaceMap::load(const std::string & file)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  blocks.clear();
+  FILE * in = fopen(file.c_str(), "rb");
+  if(! in)
+    return;                     // Nothing recorded yet
+  char buf[8];
+  uint32_t nb = 0;
+  bool ok = fread(buf, 1, 8, in) == 8 && ! memcmp(buf, magic, 8) && 
+    fread(&nb, sizeof(nb), 1, in) == 1;
+  if(ok) {
+    blocks.resize(nb);
+    ok = fread(blocks.data(), sizeof(Block), nb, in) == nb;
+  }
+  fclose(in);
+  if(! ok) {
+    blocks.clear();
+    throw std::runtime_error("'" + file + "' is not a surface map");
+  }
+}
+
+void SurfaceMap::save(const std::string & file)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::string tmp = file + ".tmp";
+  FILE * out = fopen(tmp.c_str(), "wb");
+  if(! out) {
+    std::string err = "Could not write '" + tmp + "': " + strerror(errno);
+    throw std::runtime_error(err);
+  }
+  uint32_t nb = blocks.size();
+  fwrite(magic, 1, 8, out);
+  fwrite(&nb, sizeof(nb), 1, out);
+  fwrite(blocks.data(), sizeof(Block), nb, out);
+  if(fclose(out)) {
+    std::string err = "Could not write '" + tmp + "': " + strerror(errno);
+    throw std::runtime_error(err);
+  }
+  rename(tmp.c_str(), file.c_str());
+}
+
+/// Adds @a val to @a target, saturating at the maximum of the type
+template<class T> static void saturatingAdd(T & target, unsigned long val)
+{
+  unsigned long max = (T) -1;
+  target = (target + val > max ? max : target + val);
+}
+
+void SurfaceMap::record(long sector, int nb, double latency, bool success)
+{
+  if(nb <= 0 || sector < 0)
+    return;
+  unsigned long lat = latency > 0 ? latency * 1e6 : 0;
+  long first = sector / BLOCK_SECTORS;
+  long last = (sector + nb - 1) / BLOCK_SECTORS;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if(last >= (long) blocks.size())
+    blocks.resize(last + 1, Block());
+  for(long i = first; i <= last; i++) {
+    long beg = std::max(sector, i * BLOCK_SECTORS);
+    long end = std::min(sector + nb, (i + 1) * BLOCK_SECTORS);
+    Block & b = blocks[i];
+    saturatingAdd(b.reads, 1);
+    if(! success)
+      saturatingAdd(b.failures, 1);
+    saturatingAdd(b.totalLatency, lat * (end - beg) / nb);
+    if(lat > b.maxLatency)
+      b.maxLatency = std::min(lat, 0xffffffffUL);
+  }
+}
@@ -0,0 +1,88 @@
+/**
+    \file surfacemap.hh
+    Per-sector map of the read latency and errors
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef __SURFACEMAP_H
+#define __SURFACEMAP_H
+
+#include <stdint.h>
+
+/// The latency and the outcome of the reads, for each block of
+/// BLOCK_SECTORS sectors (an ECC block) of the disc, indexed by their
+/// physical sector (see DVDSource::physicalSector()), to see where
+/// the slow and bad zones are.
+///
+/// The map is kept in a compact binary file that accumulates the
+/// reads of all the passes. It is turned into a CSV file or an image
+/// by the @a dvdmap program.
+///
+/// The file starts with the @a DVDCMAP1 magic, followed by the
+/// number of blocks as a 32-bit integer, and then the Block records,
+/// all in the native byte order.
+class SurfaceMap {
+public:
+
+  /// The number of sectors in a block
+  static const int BLOCK_SECTORS = 16;
+
+  /// What is known about one block.
+  struct Block {
+    /// The number of reads of the block (saturates)
+    uint16_t reads;
+
+    /// The number of those that failed (saturates)
+    uint16_t failures;
+
+    /// The total latency of these reads, in microseconds. A read
+    /// spanning several blocks counts in each of them for its share
+    /// of sectors.
+    uint32_t totalLatency;
+
+    /// The longest of them, in microseconds
+    uint32_t maxLatency;
+  };
+
+protected:
+
+  std::vector<Block> blocks;
+
+  std::mutex mutex;
+
+public:
+
+  /// Loads the map from @a file, if it exists. Throws an exception
+  /// if it is not a map.
+  void load(const std::string & file);
+
+  /// Writes the map to @a file (atomically).
+  void save(const std::string & file);
+
+  /// Records a read of @a nb sectors starting at the physical sector
+  /// @a sector, that took @a latency seconds. Can be called from
+  /// several threads.
+  void record(long sector, int nb, double latency, bool success);
+
+  /// The blocks
+  const std::vector<Block> & data() const {
+    return blocks;
+  };
+};
+
+#endif
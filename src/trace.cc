@@ -0,0 +1,105 @@
+/**
+    \file trace.cc
+    Implementation of the Trace class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "headers.hh"
+#include "trace.hh"
+
+#include <unistd.h>
+
+Trace * Trace::trace = NULL;
+
+Trace::Trace(FILE * o) : out(o), origin(std::chrono::steady_clock::now())
+{
+}
+
+void Trace::open(const std::string & file)
+{
+  FILE * out = fopen(file.c_str(), "w");
+  if(! out) {
+    std::string err = "Could not open trace file '" + file + "': " + 
+      strerror(errno);
+    throw std::runtime_error(err);
+  }
+  fprintf(out, "[\n");
+  trace = new Trace(out);
+  atexit(&Trace::close);
+  nameThread("main");
+}
+
+void Trace::close()
+{
+  if(! trace)
+    return;
+  std::lock_guard<std::mutex> lock(trace->mutex);
+  // The last event, without the comma
+  fprintf(trace->out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+          "\"tid\":%d,\"args\":{\"name\":\"dvdcopy\"}}\n]\n", 
+          (int) getpid(), threadID());
+  fclose(trace->out);
+  // The trace object is left there, as other threads may still
+  // try to use it, but they write nowhere.
+  trace->out = NULL;
+}
+
+int Trace::threadID()
+{
+  static std::atomic<int> nextID(1);
+  static thread_local int id = 0;
+  if(! id)
+    id = nextID++;
+  return id;
+}
+
+void Trace::write(const std::string & json)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if(out)
+    fprintf(out, "%s,\n", json.c_str());
+}
+
+void Trace::nameThread(const std::string & name)
+{
+  if(! trace)
+    return;
+  EventLog::Event args(NULL);
+  args.set("name", name);
+  char buffer[100];
+  snprintf(buffer, sizeof(buffer), 
+           "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+           "\"args\":", (int) getpid(), threadID());
+  trace->write(buffer + args.toJSON() + "}");
+}
+
+Trace::Span::~Span()
+{
+  if(! active || ! trace)
+    return;
+  std::chrono::steady_clock::time_point end = 
+    std::chrono::steady_clock::now();
+  typedef std::chrono::duration<double, std::micro> us;
+  char buffer[200];
+  snprintf(buffer, sizeof(buffer), 
+           "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+           "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":",
+           name, category, us(begin - trace->origin).count(),
+           us(end - begin).count(), (int) getpid(), threadID());
+  trace->write(buffer + args.toJSON() + "}");
+}
@@ -0,0 +1,104 @@
+/**
+    \file trace.hh
+    Traces of the reads, writes and retries
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include "eventlog.hh"
+
+#include <stdio.h>
+
+/// A trace of the reads, writes, file openings and retries, with
+/// their timing and thread, in the Chrome Trace Event format (which
+/// can be viewed with Perfetto or chrome://tracing), to find out
+/// where a copy stalls or a drive hangs.
+///
+/// The spans are only recorded once the trace is opened with open();
+/// otherwise, a Span costs next to nothing. The trace is written in
+/// the JSON array format, which the viewers read even when it is
+/// truncated because dvdcopy was killed.
+class Trace {
+  /// Where the events go
+  FILE * out;
+
+  /// So that the events of different threads do not mix
+  std::mutex mutex;
+
+  /// The time origin of the events
+  std::chrono::steady_clock::time_point origin;
+
+  Trace(FILE * out);
+
+  /// The opened trace, or NULL
+  static Trace * trace;
+
+  /// Writes an event
+  void write(const std::string & json);
+
+  /// The number of the current thread in the trace, numbered from 1
+  /// in the order in which they appear.
+  static int threadID();
+
+public:
+
+  /// Whether spans are recorded
+  static bool enabled() {
+    return trace != NULL;
+  };
+
+  /// Writes the trace to @a file from now on, until the end of the
+  /// program.
+  static void open(const std::string & file);
+
+  /// Finishes the trace.
+  static void close();
+
+  /// Gives a name to the current thread in the trace.
+  static void nameThread(const std::string & name);
+
+  /// Times its own lifetime, and records it as a span of the given
+  /// @a name and (comma-separated) categories, with the arguments
+  /// given with set().
+  class Span {
+    const char * name;
+    const char * category;
+    bool active;
+    std::chrono::steady_clock::time_point begin;
+    EventLog::Event args;
+  public:
+    Span(const char * n, const char * cat) : 
+      name(n), category(cat), active(enabled()), args(NULL) {
+      if(active)
+        begin = std::chrono::steady_clock::now();
+    };
+
+    /// Adds an argument to the span, when the trace is enabled.
+    template<typename T> Span & set(const char * key, const T & value) {
+      if(active)
+        args.set(key, value);
+      return *this;
+    };
+
+    ~Span();
+  };
+};
+
+#endif
@@ -0,0 +1,182 @@
+/**
+    \file uringqueue.cc
+    Implementation of the UringQueue class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "uringqueue.hh"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+
+static void * mapRing(int ring, size_t size, off_t offset)
+{
+  void * ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+                    MAP_SHARED | MAP_POPULATE, ring, offset);
+  if(ptr == MAP_FAILED) {
+    std::string err = "Could not map io_uring: ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  return ptr;
+}
+
+template<class T> static T * at(void * base, unsigned offset)
+{
+  return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+}
+
+UringQueue::UringQueue(unsigned entries) :
+  sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqes(NULL), toSubmit(0)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring = syscall(__NR_io_uring_setup, entries, &params);
+  if(ring < 0) {
+    std::string err = "Could not set up io_uring: ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+
+  try {
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + 
+      params.cq_entries * sizeof(struct io_uring_cqe);
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqRing = mapRing(ring, sqRingSize, IORING_OFF_SQ_RING);
+    cqRing = mapRing(ring, cqRingSize, IORING_OFF_CQ_RING);
+    sqes = static_cast<struct io_uring_sqe *>
+      (mapRing(ring, sqesSize, IORING_OFF_SQES));
+  }
+  catch(...) {
+    if(sqRing != MAP_FAILED)
+      munmap(sqRing, sqRingSize);
+    if(cqRing != MAP_FAILED)
+      munmap(cqRing, cqRingSize);
+    close(ring);
+    throw;
+  }
+
+  sqHead = at<unsigned>(sqRing, params.sq_off.head);
+  sqTail = at<unsigned>(sqRing, params.sq_off.tail);
+  sqMask = at<unsigned>(sqRing, params.sq_off.ring_mask);
+  sqEntries = at<unsigned>(sqRing, params.sq_off.ring_entries);
+  sqArray = at<unsigned>(sqRing, params.sq_off.array);
+  cqHead = at<unsigned>(cqRing, params.cq_off.head);
+  cqTail = at<unsigned>(cqRing, params.cq_off.tail);
+  cqMask = at<unsigned>(cqRing, params.cq_off.ring_mask);
+  cqes = at<struct io_uring_cqe>(cqRing, params.cq_off.cqes);
+}
+
+void UringQueue::enter(unsigned minComplete)
+{
+  while(true) {
+    int ret = syscall(__NR_io_uring_enter, ring, toSubmit, minComplete,
+                      minComplete > 0 ? IORING_ENTER_GETEVENTS : 0, 
+                      NULL, 0);
+    if(ret >= 0) {
+      toSubmit -= std::min((unsigned) ret, toSubmit);
+      return;
+    }
+    if(errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      std::string err = "Error while using io_uring: ";
+      err += strerror(errno);
+      throw std::runtime_error(err);
+    }
+  }
+}
+
+void UringQueue::queueRead(int fd, void * buffer, size_t length, 
+                           off_t position, unsigned long tag)
+{
+  unsigned tail = *sqTail;
+  if(tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= *sqEntries) {
+    submit();
+    tail = *sqTail;
+  }
+  unsigned idx = tail & *sqMask;
+  struct io_uring_sqe * sqe = sqes + idx;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<unsigned long>(buffer);
+  sqe->len = length;
+  sqe->off = position;
+  sqe->user_data = tag;
+  sqArray[idx] = idx;
+  __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+  ++toSubmit;
+}
+
+void UringQueue::submit()
+{
+  if(toSubmit > 0)
+    enter(0);
+}
+
+void UringQueue::waitCompletion(unsigned long * tag, int * result)
+{
+  while(true) {
+    unsigned head = *cqHead;
+    if(head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe * cqe = cqes + (head & *cqMask);
+      *tag = cqe->user_data;
+      *result = cqe->res;
+      __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+      return;
+    }
+    enter(1);
+  }
+}
+
+UringQueue::~UringQueue()
+{
+  munmap(sqes, sqesSize);
+  munmap(cqRing, cqRingSize);
+  munmap(sqRing, sqRingSize);
+  close(ring);
+}
+
+#else
+
+UringQueue::UringQueue(unsigned)
+{
+  throw std::runtime_error("dvdcopy was built without io_uring support");
+}
+
+void UringQueue::queueRead(int, void *, size_t, off_t, unsigned long)
+{
+}
+
+void UringQueue::submit()
+{
+}
+
+void UringQueue::waitCompletion(unsigned long *, int *)
+{
+}
+
+UringQueue::~UringQueue()
+{
+}
+
+#endif
@@ -0,0 +1,87 @@
+/**
+    \file uringqueue.hh
+    Asynchronous reads through io_uring
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __URINGQUEUE_H
+#define __URINGQUEUE_H
+
+#include <sys/types.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/// A minimal io_uring instance, used to keep several reads in
+/// flight. It talks to the kernel directly through the system calls
+/// rather than through liburing.
+///
+/// If io_uring is not available, either at compile time or because
+/// the kernel does not support it, the constructor throws an
+/// exception.
+class UringQueue {
+  /// The file descriptor of the ring
+  int ring;
+
+  /// The mappings of the submission and completion rings, and of the
+  /// submission entries
+  void * sqRing;
+  size_t sqRingSize;
+  void * cqRing;
+  size_t cqRingSize;
+  struct io_uring_sqe * sqes;
+  size_t sqesSize;
+
+  /// Pointers within the rings
+  unsigned * sqHead;
+  unsigned * sqTail;
+  unsigned * sqMask;
+  unsigned * sqEntries;
+  unsigned * sqArray;
+  unsigned * cqHead;
+  unsigned * cqTail;
+  unsigned * cqMask;
+  struct io_uring_cqe * cqes;
+
+  /// The number of entries queued but not submitted yet
+  unsigned toSubmit;
+
+  /// Calls io_uring_enter, waiting for at least @a minComplete
+  /// completions.
+  void enter(unsigned minComplete);
+
+public:
+  /// Sets up a queue able to hold @a entries requests.
+  UringQueue(unsigned entries);
+
+  /// Queues the reading of @a length bytes at @a position in @a fd
+  /// into @a buffer. The @a tag identifies the request when it
+  /// completes. The request is not sent to the kernel before
+  /// submit() is called (or the queue is full).
+  void queueRead(int fd, void * buffer, size_t length, off_t position,
+                 unsigned long tag);
+
+  /// Submits the queued requests.
+  void submit();
+
+  /// Waits for the next completion, and returns its tag and result,
+  /// ie the number of bytes read or minus the error number.
+  void waitCompletion(unsigned long * tag, int * result);
+
+  ~UringQueue();
+};
+
+#endif